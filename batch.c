@@ -0,0 +1,185 @@
+/*
+    batch.c
+    Generates a large set of levels on every processor and writes them to one file.
+
+    Each worker thread makes levels (dug out caves, with the player, key and
+    exit placed at the chokepoints) and writes them out with one of:
+      uring   the background writer, using io_uring (see writer.c),
+      thread  the background writer, using pwrite on its thread,
+      stdio   fwrite on the worker itself, taking turns with a lock,
+      none    nothing, to see how fast the levels are made.
+    The number of levels made each second shows how much of the time the
+    workers spend waiting on the disk.
+
+    Each level is also measured as it is made, and the metrics are written
+    beside the levels, to out.lvl.metrics (see metrics.c and query.c).
+
+    Build with `cc -O2 batch.c -o batch -pthread -lm`.
+    Run with `./batch out.lvl [levels] [threads] [uring|thread|stdio|none]`.
+*/
+
+#include <stdatomic.h>
+
+#define NO_MAIN
+#include "level.c"
+#include "writer.c"
+#include "metrics.c"
+
+// Levels a worker makes each time it takes work.
+#define BATCH_CHUNK 64
+// Levels in each buffer handed to the writer.
+#define BATCH_BUFFER_LEVELS 256
+
+enum { WRITE_URING, WRITE_THREAD, WRITE_STDIO, WRITE_NONE };
+
+typedef struct {
+    int mode;
+    Level_Writer * writer;
+    FILE * file;
+    pthread_mutex_t file_lock;
+    s64 levels_written;
+    Metrics_Table metrics;
+    s64 level_count;
+    atomic_llong next_level;
+    atomic_bool failed;
+} Batch;
+
+typedef struct {
+    Batch * batch;
+    int index;
+} Batch_Worker;
+
+void make_batch_level(Level level) {
+    fill_level(level, WALL);
+    digger_generator(level, NULL);
+    chokepoint_placer(level, NULL, 1);
+}
+
+// Hands a full buffer to the writer, and puts the metrics of its levels
+// where the levels are going in the file.
+void queue_batch_buffer(Batch * batch, Write_Buffer * buffer, u16 (*metrics)[METRIC_COUNT]) {
+    int count = buffer->size / sizeof(Level);
+    s64 first = queue_write(batch->writer, buffer) / sizeof(Level);
+    for (int i = 0; i < count; ++i) set_level_metrics(&batch->metrics, first + i, metrics[i]);
+}
+
+void * batch_thread(void * data) {
+    Batch_Worker * worker = data;
+    Batch * batch = worker->batch;
+    reset_seed(worker->index + 1, 0);
+    Write_Buffer * buffer = NULL;
+    u16 metrics[BATCH_BUFFER_LEVELS][METRIC_COUNT];
+    Level level;
+    while (!atomic_load(&batch->failed)) {
+        s64 start = atomic_fetch_add(&batch->next_level, BATCH_CHUNK);
+        if (start >= batch->level_count) break;
+        s64 end = MIN(batch->level_count, start + BATCH_CHUNK);
+        for (s64 i = start; i < end; ++i) {
+            make_batch_level(level);
+            if (batch->mode == WRITE_NONE) continue;
+            bool ok = true;
+            if (batch->mode == WRITE_URING || batch->mode == WRITE_THREAD) {
+                if (buffer && buffer->size == BATCH_BUFFER_LEVELS * sizeof(Level)) {
+                    queue_batch_buffer(batch, buffer, metrics);
+                    buffer = NULL;
+                }
+                if (!buffer) buffer = take_write_buffer(batch->writer);
+                if (buffer) {
+                    measure_level(level, metrics[buffer->size / sizeof(Level)]);
+                    memcpy(buffer->bytes + buffer->size, level, sizeof(Level));
+                    buffer->size += sizeof(Level);
+                }
+                ok = buffer != NULL;
+            } else if (batch->mode == WRITE_STDIO) {
+                u16 level_metrics[METRIC_COUNT];
+                measure_level(level, level_metrics);
+                pthread_mutex_lock(&batch->file_lock);
+                s64 index = batch->levels_written++;
+                ok = write_level(batch->file, level);
+                pthread_mutex_unlock(&batch->file_lock);
+                set_level_metrics(&batch->metrics, index, level_metrics);
+            }
+            if (!ok) atomic_store(&batch->failed, true);
+        }
+    }
+    if (buffer) queue_batch_buffer(batch, buffer, metrics);
+    return NULL;
+}
+
+int main(int argument_count, char ** arguments) {
+    if (argument_count < 2) {
+        fprintf(stderr, "Usage: %s out.lvl [levels] [threads] [uring|thread|stdio|none]\n", arguments[0]);
+        return 1;
+    }
+    char * path = arguments[1];
+    Batch batch = { .level_count = argument_count > 2 ? atoll(arguments[2]) : 100000 };
+    int thread_count = argument_count > 3 ? atoi(arguments[3]) : sysconf(_SC_NPROCESSORS_ONLN);
+    char * modes[] = { "uring", "thread", "stdio", "none" };
+    for (int m = 0; argument_count > 4 && m < 4; ++m) {
+        if (strcmp(arguments[4], modes[m]) == 0) batch.mode = m;
+    }
+    thread_count = MAX(1, thread_count);
+    atomic_init(&batch.next_level, 0);
+    atomic_init(&batch.failed, false);
+
+    if (batch.mode != WRITE_NONE && !make_metrics_table(&batch.metrics, batch.level_count)) {
+        fprintf(stderr, "Not enough memory for the metrics.\n");
+        return 1;
+    }
+
+    Level_Writer writer;
+    if (batch.mode == WRITE_URING || batch.mode == WRITE_THREAD) {
+        if (!open_level_writer(&writer, path, BATCH_BUFFER_LEVELS * sizeof(Level), 4 * thread_count + 8, batch.mode == WRITE_URING)) {
+            fprintf(stderr, "Could not open %s.\n", path);
+            return 1;
+        }
+        batch.writer = &writer;
+        if (batch.mode == WRITE_URING && !writer.use_uring) {
+            fprintf(stderr, "io_uring is not available, writing on a thread instead.\n");
+        }
+    } else if (batch.mode == WRITE_STDIO) {
+        batch.file = fopen(path, "wb");
+        if (!batch.file) {
+            fprintf(stderr, "Could not open %s.\n", path);
+            return 1;
+        }
+        pthread_mutex_init(&batch.file_lock, NULL);
+    }
+
+    double start = seconds_now();
+    pthread_t threads[thread_count];
+    Batch_Worker workers[thread_count];
+    for (int i = 0; i < thread_count; ++i) {
+        workers[i] = (Batch_Worker){ &batch, i };
+        pthread_create(&threads[i], NULL, batch_thread, &workers[i]);
+    }
+    for (int i = 0; i < thread_count; ++i) pthread_join(threads[i], NULL);
+    double made = seconds_now() - start;
+
+    bool ok = !atomic_load(&batch.failed);
+    if (batch.writer) ok = close_level_writer(&writer) && ok;
+    if (batch.file) ok = fclose(batch.file) == 0 && ok;
+    double seconds = seconds_now() - start;
+    if (!ok) {
+        fprintf(stderr, "Could not write all the levels to %s.\n", path);
+        return 1;
+    }
+    if (batch.mode != WRITE_NONE) {
+        char metrics_path[strlen(path) + sizeof(".metrics")];
+        sprintf(metrics_path, "%s.metrics", path);
+        if (!write_metrics_file(metrics_path, &batch.metrics)) {
+            fprintf(stderr, "Could not write the metrics to %s.\n", metrics_path);
+            return 1;
+        }
+        free_metrics_table(&batch.metrics);
+    }
+
+    fprintf(stderr, "%lld levels with %d threads, writing with %s.\n",
+        (long long)batch.level_count, thread_count, modes[batch.mode]);
+    fprintf(stderr, "Made in %.3f s, all written in %.3f s: %.0f levels per second (%.1f MB per second).\n",
+        made, seconds, batch.level_count / seconds, batch.level_count * sizeof(Level) / seconds / 1e6);
+    if (batch.writer) {
+        fprintf(stderr, "%d buffers of %zu KB, at most %d waiting to be written.\n",
+            writer.buffer_count, BATCH_BUFFER_LEVELS * sizeof(Level) / 1024, writer.most_queued);
+    }
+}
@@ -0,0 +1,293 @@
+/*
+    bot.c
+    Plays levels the way a reasonable player would, to find out how they play.
+
+    Whether a level can be completed says little about what playing it is
+    like. The bot plays it by the same rules as the game (see rules.c): it
+    picks up all the gold it can reach, nearest first, then the keys, then
+    any gold it could only reach over a key, then goes to the exit. It never
+    steps on spikes, nor on an open exit before it is going for it, and when
+    two steps are as good as each other it takes the one further from
+    enemies. It keeps off keys while first going for the gold, as taking
+    the last one opens the exit, and any gold past the exit could then not
+    be reached without ending the game.
+
+    Each step goes down a distance field: the number of steps from every
+    tile to the nearest thing the bot is after. Walls do not move, so the
+    field stays right until one of those things is picked up, and only then
+    is it worked out again. A level takes one breadth first search for each
+    piece of gold, rather than one for every step.
+
+    Run over a set of levels, it reports how many were completed, how many
+    steps they took, and how much of the gold was picked up. Each level is
+    played with its own seed, so enemies move the same way however many
+    threads there are.
+
+    Build with `cc -O2 bot.c -o bot -pthread -lm`.
+    Run with `./bot [threads] [seed] < levels` on a set of levels saved one
+    after another.
+*/
+
+#include "rules.c"
+
+// A level not finished in this many steps is given up on.
+#define BOT_MAX_STEPS (4 * LEVEL_SIZE * LEVEL_SIZE)
+#define BOT_UNREACHED 0xffff
+
+enum { BOT_GOLD, BOT_KEYS, BOT_LAST_GOLD, BOT_EXIT };
+
+typedef struct {
+    bool completed;
+    // Set if the bot could not reach a key or the exit.
+    bool stuck;
+    int steps;
+    int gold, gold_available;
+    int enemies_killed;
+} Bot_Result;
+
+// Whether the bot will walk on a tile while going for 'goal'. Spikes end
+// the game, and so does an exit without a lock on it, which the bot only
+// walks onto when it is going for the exit.
+bool bot_can_walk(Tile tile, int goal) {
+    if (tile & (BIT(WALL) | BIT(SPIKES))) return false;
+    if (goal == BOT_GOLD && (tile & BIT(KEY))) return false;
+    return goal == BOT_EXIT || (tile & (BIT(EXIT) | BIT(LOCK))) != BIT(EXIT);
+}
+
+bool level_has_any(Level level, Tile bits) {
+    for (int i = 0; i < LEVEL_SIZE * LEVEL_SIZE; ++i) {
+        if (level[i] & bits) return true;
+    }
+    return false;
+}
+
+// Finds the steps from every tile to the nearest tile with any of 'targets',
+// walking only where the bot would while going for 'goal'.
+// Returns the number of target tiles.
+int bot_distance_field(Level level, Tile targets, int goal, u16 * distance) {
+    u16 queue[LEVEL_SIZE * LEVEL_SIZE];
+    int head = 0, tail = 0;
+    for (int i = 0; i < LEVEL_SIZE * LEVEL_SIZE; ++i) {
+        distance[i] = BOT_UNREACHED;
+        if ((level[i] & targets) && bot_can_walk(level[i], goal)) {
+            distance[i] = 0;
+            queue[tail++] = i;
+        }
+    }
+    int target_count = tail;
+    while (head < tail) {
+        int tile = queue[head++];
+        int x = tile % LEVEL_SIZE, y = tile / LEVEL_SIZE;
+        int neighbours[4] = { tile - LEVEL_SIZE, tile + LEVEL_SIZE, tile - 1, tile + 1 };
+        bool inside[4] = { y > 0, y < LEVEL_SIZE - 1, x > 0, x < LEVEL_SIZE - 1 };
+        for (int n = 0; n < 4; ++n) {
+            int next = neighbours[n];
+            if (!inside[n] || distance[next] != BOT_UNREACHED || !bot_can_walk(level[next], goal)) continue;
+            distance[next] = distance[tile] + 1;
+            queue[tail++] = next;
+        }
+    }
+    return target_count;
+}
+
+// How close enemies are to a tile: one on it counts for more than one next to it.
+int enemy_danger(Level level, int tile) {
+    int danger = (level[tile] & BIT(ENEMY)) ? 4 : 0;
+    int neighbours[4] = { tile - LEVEL_SIZE, tile + LEVEL_SIZE, tile - 1, tile + 1 };
+    for (int n = 0; n < 4; ++n) {
+        if (neighbours[n] >= 0 && neighbours[n] < LEVEL_SIZE * LEVEL_SIZE) {
+            danger += (level[neighbours[n]] >> ENEMY) & 1;
+        }
+    }
+    return danger;
+}
+
+// Plays a copy of the level until it ends or the bot gives up.
+Bot_Result play_level(Level start) {
+    Level level;
+    memcpy(level, start, sizeof(Level));
+    Bot_Result result = {0};
+    Game game = {0};
+    for (int i = 0; i < LEVEL_SIZE * LEVEL_SIZE; ++i) result.gold_available += (level[i] >> GOLD) & 1;
+
+    Tile goals[] = { BIT(GOLD), BIT(KEY), BIT(GOLD), BIT(EXIT) };
+    int goal = BOT_GOLD;
+    u16 distance[LEVEL_SIZE * LEVEL_SIZE];
+    bool field_is_stale = true;
+    int px, py;
+    while (find_player(level, &px, &py) && result.steps < BOT_MAX_STEPS) {
+        int player = px + py * LEVEL_SIZE;
+        if (field_is_stale) {
+            bot_distance_field(level, goals[goal], goal, distance);
+            field_is_stale = false;
+        }
+        if (distance[player] == BOT_UNREACHED) {
+            // No gold left that can be reached, or no key left: go for the next thing.
+            if (goal == BOT_EXIT || (goal == BOT_KEYS && level_has_any(level, BIT(KEY)))) {
+                result.stuck = true;
+                break;
+            }
+            ++goal;
+            field_is_stale = true;
+            continue;
+        }
+
+        int directions[4] = { UP, DOWN, LEFT, RIGHT };
+        int neighbours[4] = { player - LEVEL_SIZE, player + LEVEL_SIZE, player - 1, player + 1 };
+        int best = -1, best_danger = INT_MAX;
+        for (int n = 0; n < 4; ++n) {
+            if (distance[neighbours[n]] != distance[player] - 1) continue;
+            int danger = enemy_danger(level, neighbours[n]);
+            if (danger < best_danger) {
+                best = n;
+                best_danger = danger;
+            }
+        }
+        // Standing on what it is after, which happens when a key is under the player.
+        if (best < 0) {
+            ++goal;
+            field_is_stale = true;
+            if (goal > BOT_EXIT) break;
+            continue;
+        }
+
+        // Picking up the last key opens the exit, which changes where the
+        // bot can walk, so that also calls for a new field.
+        bool picks_up = level[neighbours[best]] & (goals[goal] | BIT(KEY));
+        bool game_over = update_level(level, directions[best], &game);
+        ++result.steps;
+        ++game.steps_taken;
+        if (game_over) {
+            result.completed = true;
+            break;
+        }
+        if (picks_up) field_is_stale = true;
+    }
+    result.gold = game.gold_collected;
+    result.enemies_killed = game.enemies_killed;
+    return result;
+}
+
+#ifndef NO_MAIN
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+// Levels a thread takes each time it takes work.
+#define BOT_CHUNK 64
+
+typedef struct {
+    Tile (*levels)[LEVEL_SIZE * LEVEL_SIZE];
+    Bot_Result * results;
+    s64 level_count;
+    u64 seed;
+    atomic_llong next_level;
+} Bot_Batch;
+
+void * bot_thread(void * data) {
+    Bot_Batch * batch = data;
+    while (true) {
+        s64 start = atomic_fetch_add(&batch->next_level, BOT_CHUNK);
+        if (start >= batch->level_count) break;
+        s64 end = MIN(batch->level_count, start + BOT_CHUNK);
+        for (s64 i = start; i < end; ++i) {
+            reset_seed(batch->seed, i);
+            batch->results[i] = play_level(batch->levels[i]);
+        }
+    }
+    return NULL;
+}
+
+int compare_ints(const void * a, const void * b) {
+    return *(int *)a - *(int *)b;
+}
+
+// Prints the lowest, 10th, 50th and 90th percentiles and highest of some values.
+void print_spread(char * name, int * values, int count) {
+    if (count == 0) {
+        printf("%-24s none\n", name);
+        return;
+    }
+    qsort(values, count, sizeof(int), compare_ints);
+    printf("%-24s min %4d  p10 %4d  p50 %4d  p90 %4d  max %4d\n", name,
+        values[0], values[count / 10], values[count / 2], values[count * 9 / 10], values[count - 1]);
+}
+
+int main(int argument_count, char ** arguments) {
+    int thread_count = argument_count > 1 ? atoi(arguments[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+    u64 seed = argument_count > 2 ? strtoull(arguments[2], NULL, 10) : 1;
+    thread_count = MAX(1, thread_count);
+
+    // Read the whole set of levels.
+    s64 capacity = 1024, level_count = 0;
+    Tile (*levels)[LEVEL_SIZE * LEVEL_SIZE] = malloc(sizeof(Level) * capacity);
+    while (levels) {
+        if (level_count == capacity) {
+            capacity *= 2;
+            void * more = realloc(levels, sizeof(Level) * capacity);
+            if (!more) {
+                free(levels);
+                levels = NULL;
+                break;
+            }
+            levels = more;
+        }
+        if (!load_level(stdin, levels[level_count])) break;
+        ++level_count;
+    }
+    Bot_Result * results = calloc(MAX(1, level_count), sizeof(Bot_Result));
+    int * values = malloc(sizeof(int) * MAX(1, level_count));
+    if (!levels || !results || !values) {
+        fprintf(stderr, "Not enough memory for the levels.\n");
+        return 1;
+    }
+
+    Bot_Batch batch = { levels, results, level_count, seed };
+    atomic_init(&batch.next_level, 0);
+    double start = seconds_now();
+    pthread_t threads[thread_count];
+    int started = 0;
+    for (int i = 1; i < thread_count; ++i) {
+        if (pthread_create(&threads[started], NULL, bot_thread, &batch) == 0) ++started;
+    }
+    bot_thread(&batch);
+    for (int i = 0; i < started; ++i) pthread_join(threads[i], NULL);
+    double seconds = seconds_now() - start;
+
+    s64 completed = 0, stuck = 0, gold = 0, gold_available = 0, kills = 0;
+    for (s64 i = 0; i < level_count; ++i) {
+        completed += results[i].completed;
+        stuck += results[i].stuck;
+        gold += results[i].gold;
+        gold_available += results[i].gold_available;
+        kills += results[i].enemies_killed;
+    }
+    s64 gave_up = level_count - completed - stuck;
+    printf("%lld levels played in %.3f s with %d threads (%.0f levels per second).\n",
+        (long long)level_count, seconds, thread_count, level_count / MAX(seconds, 1e-9));
+    printf("Completed %lld (%.1f%%), could not reach the key or exit %lld, gave up %lld.\n",
+        (long long)completed, 100.0 * completed / MAX(1, level_count),
+        (long long)stuck, (long long)gave_up);
+    printf("Gold picked up: %lld of %lld (%.1f%%). Enemies killed: %.2f per level.\n",
+        (long long)gold, (long long)gold_available, 100.0 * gold / MAX(1, gold_available),
+        (double)kills / MAX(1, level_count));
+
+    int count = 0;
+    for (s64 i = 0; i < level_count; ++i) if (results[i].completed) values[count++] = results[i].steps;
+    print_spread("Steps to complete:", values, count);
+    count = 0;
+    for (s64 i = 0; i < level_count; ++i) values[count++] = results[i].gold;
+    print_spread("Gold picked up:", values, count);
+    count = 0;
+    for (s64 i = 0; i < level_count; ++i) {
+        if (results[i].gold_available) values[count++] = 100 * results[i].gold / results[i].gold_available;
+    }
+    print_spread("Percent of gold:", values, count);
+
+    free(values);
+    free(results);
+    free(levels);
+}
+
+#endif
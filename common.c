@@ -15,6 +15,7 @@
 #include <float.h>
 #include <limits.h>
 #include <stdint.h>
+#include <time.h>
 
 // Custom primitive types.
 typedef uint8_t u8;
@@ -51,6 +52,23 @@ typedef u16 Tile;
 #define LEVEL_SIZE 22
 typedef Tile Level[LEVEL_SIZE * LEVEL_SIZE];
 
+// Maps are levels of any size, for worlds that are too big for a single Level.
+// The tiles are stored in the same order as a Level, one row after another,
+// unless 'block_shift' is set. Then they are stored in square blocks with sides
+// of 1 << block_shift tiles, one block after another, so that tiles close
+// together in the map are close together in memory. Use map_tile to find a tile.
+typedef struct {
+    int width, height;
+    Tile * tiles;
+    int block_shift;
+    // Number of blocks across each row of blocks.
+    int blocks_x;
+    // Distance from each tile to the nearest wall, one row after another,
+    // worked out when first asked for by map_wall_distance (see distance.c).
+    // Code that moves walls must call forget_wall_distance.
+    float * wall_distance;
+} Map;
+
 // The width and height of each tile in pixels.
 #define SPRITE_SIZE 32
 
@@ -66,7 +84,8 @@ enum { UP = 1, DOWN, LEFT, RIGHT };
 
 #define sq(x) ((x) * (x))
 
-u64 random_seed[2] = { (u64)__DATE__, (u64)__TIME__ };
+// Each thread has its own generator state, so threads can generate in parallel.
+_Thread_local u64 random_seed[2] = { (u64)__DATE__, (u64)__TIME__ };
 // Xoroshiro128+ pseudo-random number generator.
 u64 random_u64() {
     u64 s0 = random_seed[0];
@@ -87,6 +106,14 @@ void set_seed(u64 a, u64 b) {
     for (int i = 0; i < 64; ++i) random_u64();
 }
 
+// Set the seed from a fixed starting state, so that the same seed always
+// gives the same numbers, whatever was generated before.
+void reset_seed(u64 a, u64 b) {
+    random_seed[0] = 0x9e3779b97f4a7c15;
+    random_seed[1] = 0xbf58476d1ce4e5b9;
+    set_seed(a, b);
+}
+
 // Get a random float between 0.0 and 1.0.
 float random_float() {
     return (float)random_u64() / (float)UINT64_MAX;
@@ -103,6 +130,54 @@ bool chance(float chance_to_be_true) {
     return random_float() <= chance_to_be_true;
 }
 
+// Seconds since some fixed point, for timing things.
+double seconds_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Allocates a map with every tile cleared.
+// The tiles pointer is NULL if the allocation failed.
+Map make_map(int width, int height) {
+    Map map = { width, height, NULL };
+    map.tiles = calloc((size_t)width * height, sizeof(Tile));
+    return map;
+}
+
+// Throws away the wall distances, so they are worked out again when next needed.
+void forget_wall_distance(Map * map) {
+    free(map->wall_distance);
+    map->wall_distance = NULL;
+}
+
+void free_map(Map * map) {
+    free(map->tiles);
+    map->tiles = NULL;
+    forget_wall_distance(map);
+}
+
+// Wraps a level so it can be passed to code that works on maps.
+// No copy is made, so changes to the map are changes to the level.
+Map level_as_map(Level level) {
+    return (Map){ LEVEL_SIZE, LEVEL_SIZE, level };
+}
+
+Tile * map_tile(Map * map, int x, int y) {
+    if (map->block_shift == 0) return &map->tiles[x + (size_t)y * map->width];
+    int shift = map->block_shift;
+    int inner = (1 << shift) - 1;
+    size_t block = (size_t)(x >> shift) + (size_t)(y >> shift) * map->blocks_x;
+    return &map->tiles[(block << (shift * 2)) + (x & inner) + ((y & inner) << shift)];
+}
+
+// Number of tiles held in memory, including any padding at the edges of blocks.
+size_t map_tile_count(Map * map) {
+    if (map->block_shift == 0) return (size_t)map->width * map->height;
+    size_t blocks_y = (map->height + (1 << map->block_shift) - 1) >> map->block_shift;
+    return ((size_t)map->blocks_x * blocks_y) << (map->block_shift * 2);
+}
+
 // Calls a function for all tiles that are touched by a basic four-way flood fill
 // starting at tile x,y. You can pass data into the given function using 'data'.
 // 'mask' allows you to set which entity bits to check when flooding.
@@ -160,6 +235,131 @@ int flood(Level level, int start_x, int start_y, Tile mask, Tile target, Flood_F
     return steps_taken;
 }
 
+// Does the same as flood, but for a map of any size.
+// Fills a row at a time, moving on to the rows above and below, so that the
+// tiles it touches are close together in memory, and only a bit of memory
+// per tile is needed to remember where it has been.
+s64 map_flood(Map * map, int start_x, int start_y, Tile mask, Tile target, Flood_Func func, void * data) {
+    u8 * visited = calloc((map_tile_count(map) + 7) / 8, 1);
+    s64 steps_taken = 0;
+
+    #define OFFSET(x, y) (map_tile(map, x, y) - map->tiles)
+    #define VISITED(x, y) (visited[OFFSET(x, y) >> 3] & BIT(OFFSET(x, y) & 7))
+    #define OPEN(x, y) (!VISITED(x, y) && (*map_tile(map, x, y) & mask) == (target & mask))
+
+    // Stack of tiles that start runs of unvisited tiles still to be filled.
+    int stack_capacity = 1024, stack_count = 0;
+    int * stack = malloc(sizeof(int) * 2 * stack_capacity);
+    stack[stack_count * 2] = start_x;
+    stack[stack_count * 2 + 1] = start_y;
+    ++stack_count;
+
+    while (stack_count) {
+        --stack_count;
+        int x = stack[stack_count * 2];
+        int y = stack[stack_count * 2 + 1];
+        if (!OPEN(x, y)) continue;
+
+        // Find the whole run of open tiles on this row.
+        int left = x, right = x;
+        while (left > 0 && OPEN(left - 1, y)) --left;
+        while (right < map->width - 1 && OPEN(right + 1, y)) ++right;
+
+        for (int fx = left; fx <= right; ++fx) {
+            size_t offset = OFFSET(fx, y);
+            visited[offset >> 3] |= BIT(offset & 7);
+            ++steps_taken;
+            if (func(map_tile(map, fx, y), fx, y, data)) {
+                free(stack);
+                free(visited);
+                return steps_taken;
+            }
+        }
+
+        // Add the start of each open run in the rows above and below.
+        for (int ny = y - 1; ny <= y + 1; ny += 2) {
+            if (ny < 0 || ny >= map->height) continue;
+            bool in_run = false;
+            for (int fx = left; fx <= right; ++fx) {
+                bool open = OPEN(fx, ny);
+                if (open && !in_run) {
+                    if (stack_count == stack_capacity) {
+                        stack_capacity *= 2;
+                        stack = realloc(stack, sizeof(int) * 2 * stack_capacity);
+                    }
+                    stack[stack_count * 2] = fx;
+                    stack[stack_count * 2 + 1] = ny;
+                    ++stack_count;
+                }
+                in_run = open;
+            }
+        }
+    }
+
+    #undef OFFSET
+    #undef VISITED
+    #undef OPEN
+
+    free(stack);
+    free(visited);
+    return steps_taken;
+}
+
+// Finds the floor tile closest to the middle of the map, searching outward in
+// square rings. Returns false if there is no floor at all.
+bool find_middle_floor(Map * map, int * found_x, int * found_y) {
+    int cx = map->width / 2;
+    int cy = map->height / 2;
+    int max_radius = MAX(map->width, map->height);
+    for (int r = 0; r <= max_radius; ++r) {
+        for (int y = cy - r; y <= cy + r; ++y) {
+            if (y < 0 || y >= map->height) continue;
+            // Only the edges of the ring, as the inside was searched already.
+            int step = (y == cy - r || y == cy + r) ? 1 : MAX(1, 2 * r);
+            for (int x = cx - r; x <= cx + r; x += step) {
+                if (x < 0 || x >= map->width) continue;
+                if (*map_tile(map, x, y) == BIT(FLOOR)) {
+                    *found_x = x;
+                    *found_y = y;
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+typedef struct {
+    u8 * reached;
+    int width;
+} Reached_Tiles;
+
+bool mark_reached_tile(Tile * tile, int x, int y, void * data) {
+    Reached_Tiles * reached = data;
+    size_t i = x + (size_t)y * reached->width;
+    reached->reached[i >> 3] |= BIT(i & 7);
+    return false;
+}
+
+// Turns every floor tile that cannot be reached from x,y into wall.
+// Returns false if there was not enough memory.
+bool wall_up_unreached_floor(Map * map, int x, int y) {
+    forget_wall_distance(map);
+    Reached_Tiles reached = { calloc(((size_t)map->width * map->height + 7) / 8, 1), map->width };
+    if (!reached.reached) return false;
+    map_flood(map, x, y, BIT(FLOOR) | BIT(WALL), BIT(FLOOR), mark_reached_tile, &reached);
+
+    for (int ty = 0; ty < map->height; ++ty) {
+        for (int tx = 0; tx < map->width; ++tx) {
+            size_t i = tx + (size_t)ty * map->width;
+            Tile * tile = map_tile(map, tx, ty);
+            if ((*tile & BIT(FLOOR)) && (reached.reached[i >> 3] & BIT(i & 7)) == 0) *tile = BIT(WALL);
+        }
+    }
+    free(reached.reached);
+    return true;
+}
+
 // Passed into flood, it will record all the entity types that were flooded.
 // It takes the address of a Tile in data, where it will record the results.
 bool flood_record_tiles(Tile * tile, int x, int y, void * data) {
@@ -168,6 +368,34 @@ bool flood_record_tiles(Tile * tile, int x, int y, void * data) {
     return false;
 }
 
+// Checks whether blocking a tile could cut its walkable neighbours off from
+// each other, looking only at the eight tiles around it. 'ring' has a bit set
+// for each walkable neighbour, going clockwise from the top:
+// up, up-right, right, down-right, down, down-left, left, up-left.
+// If this returns false, the tile can be blocked without disconnecting any
+// two other tiles of the level, as there is always a way around it.
+bool is_local_cut(u8 ring) {
+    // Neighbours next to each other in the ring are also next to each other in
+    // the level, so the straight neighbours must all be in one unbroken run.
+    int runs_with_straight_neighbour = 0;
+    for (int i = 0; i < 8; i += 2) {
+        if ((ring & BIT(i)) == 0) continue;
+        // Only count a run from its first straight neighbour, going clockwise.
+        int j = i;
+        bool first = true;
+        while (true) {
+            j = (j + 7) % 8;
+            if ((ring & BIT(j)) == 0 || j == i) break;
+            if (j % 2 == 0) {
+                first = false;
+                break;
+            }
+        }
+        if (first) ++runs_with_straight_neighbour;
+    }
+    return runs_with_straight_neighbour > 1;
+}
+
 bool find_player(Level level, int * px, int * py) {
     for (int y = 0; y < LEVEL_SIZE; ++y) {
         for (int x = 0; x < LEVEL_SIZE; ++x) {
@@ -193,9 +421,10 @@ bool level_is_completable(Level level) {
     return (entities_seen & (BIT(KEY) | BIT(EXIT))) == (BIT(KEY) | BIT(EXIT));
 }
 
-// Load a level from binary '.lvl' file.
+// Load a level from binary '.lvl' file. Fails if the file ends before the
+// whole level is read. See validate.c to check that what was read makes sense.
 bool load_level(FILE * file, Level level) {
-    return (bool)fread(level, sizeof(Tile), LEVEL_SIZE * LEVEL_SIZE, file);
+    return fread(level, sizeof(Tile), LEVEL_SIZE * LEVEL_SIZE, file) == LEVEL_SIZE * LEVEL_SIZE;
 }
 
 // Level is written out as binary format in native byte ordering.
@@ -0,0 +1,295 @@
+/*
+    cow.c
+    Levels that can be copied for nothing, sharing their tiles until one of the copies changes them.
+
+    Searching for a level, or for a way through one, means trying many small
+    changes, each on its own copy of the level. Copying every tile for each
+    branch of the search costs far more than the few tiles that change, and
+    more so the larger the map.
+
+    Here the tiles are kept in blocks of 8 by 8, and the blocks are the
+    leaves of a tree, each node of which holds 8 by 8 children. A map of up
+    to 64 by 64 tiles has one node, up to 512 by 512 has two levels, and so
+    on. Every block and node counts how many parents point to it. Forking a
+    map only counts one more user of its root. Changing a tile copies the
+    nodes on the way down to its block that are shared, and the block if it
+    is shared, and changes the copy. Everything else stays shared. So a fork
+    costs nothing, and a change after it costs a block and a node or two
+    however big the map is. A map that is not shared is changed in place.
+    For a single 22 by 22 level a plain copy is still quicker, as it is
+    hardly bigger than the node and block that a change copies; the tree
+    pays off from a few hundred tiles across.
+
+    A new map points every child of a node at one shared block filled with
+    the same tile, so it is small until it is written to.
+
+    Counts are atomic, so a map can be forked on one thread and its forks
+    read and changed on others, as long as each map (as opposed to the tiles
+    it shares) is only used by one thread at a time.
+
+    Build with `cc -O2 cow.c -o cow -lm`.
+    Run with `./cow [size] [forks]` to compare forking and changing a map
+    against copying it, for a size by size map.
+*/
+
+#include <stdatomic.h>
+#include "common.c"
+
+#define COW_SHIFT 3
+#define COW_SIDE (1 << COW_SHIFT)
+#define COW_CHILDREN (COW_SIDE * COW_SIDE)
+
+typedef struct {
+    atomic_int refs;
+    Tile tiles[COW_CHILDREN];
+} Cow_Block;
+
+typedef struct Cow_Node Cow_Node;
+struct Cow_Node {
+    atomic_int refs;
+    // Nodes at the bottom of the tree hold blocks, the others hold nodes.
+    union {
+        Cow_Node * nodes[COW_CHILDREN];
+        Cow_Block * blocks[COW_CHILDREN];
+    };
+};
+
+typedef struct {
+    int width, height;
+    // Levels of nodes in the tree, at least 1.
+    int depth;
+    Cow_Node * root;
+} Cow_Map;
+
+void release_cow_node(Cow_Node * node, int depth) {
+    if (atomic_fetch_sub(&node->refs, 1) != 1) return;
+    for (int c = 0; c < COW_CHILDREN; ++c) {
+        if (depth > 1) {
+            release_cow_node(node->nodes[c], depth - 1);
+        } else if (atomic_fetch_sub(&node->blocks[c]->refs, 1) == 1) {
+            free(node->blocks[c]);
+        }
+    }
+    free(node);
+}
+
+// Makes a map with every tile set to 'fill'. Returns false if out of memory.
+bool make_cow_map(Cow_Map * map, int width, int height, Tile fill) {
+    *map = (Cow_Map){ width, height, 1 };
+    while ((COW_SIDE << (COW_SHIFT * map->depth)) < MAX(width, height)) ++map->depth;
+
+    Cow_Block * block = malloc(sizeof(Cow_Block));
+    if (!block) return false;
+    atomic_init(&block->refs, 0);
+    for (int i = 0; i < COW_CHILDREN; ++i) block->tiles[i] = fill;
+
+    // Each level of the tree is one node, shared by every child of the level above.
+    Cow_Node * below = NULL;
+    for (int d = 1; d <= map->depth; ++d) {
+        Cow_Node * node = malloc(sizeof(Cow_Node));
+        if (!node) {
+            if (below) release_cow_node(below, d - 1);
+            else free(block);
+            return false;
+        }
+        atomic_init(&node->refs, 1);
+        for (int c = 0; c < COW_CHILDREN; ++c) {
+            if (d == 1) node->blocks[c] = block;
+            else node->nodes[c] = below;
+        }
+        if (d == 1) atomic_store(&block->refs, COW_CHILDREN);
+        else atomic_store(&below->refs, COW_CHILDREN);
+        below = node;
+    }
+    map->root = below;
+    return true;
+}
+
+void free_cow_map(Cow_Map * map) {
+    if (map->root) release_cow_node(map->root, map->depth);
+    *map = (Cow_Map){0};
+}
+
+// Gives a copy of the map, sharing all of its tiles.
+Cow_Map fork_cow_map(Cow_Map * map) {
+    atomic_fetch_add(&map->root->refs, 1);
+    return *map;
+}
+
+// Which child of a node at 'depth' the tile at x, y is under.
+int cow_child(int x, int y, int depth) {
+    int shift = COW_SHIFT * depth;
+    return ((x >> shift) & (COW_SIDE - 1)) + ((y >> shift) & (COW_SIDE - 1)) * COW_SIDE;
+}
+
+Tile cow_tile(Cow_Map * map, int x, int y) {
+    Cow_Node * node = map->root;
+    for (int d = map->depth; d > 1; --d) node = node->nodes[cow_child(x, y, d)];
+    return node->blocks[cow_child(x, y, 1)]->tiles[cow_child(x, y, 0)];
+}
+
+// Gets a tile to change, copying the block it is in and the nodes above
+// that first, if they are shared. Returns NULL if out of memory.
+Tile * cow_tile_for_write(Cow_Map * map, int x, int y) {
+    Cow_Node ** link = &map->root;
+    for (int d = map->depth; d >= 1; --d) {
+        Cow_Node * node = *link;
+        if (atomic_load(&node->refs) > 1) {
+            Cow_Node * copy = malloc(sizeof(Cow_Node));
+            if (!copy) return NULL;
+            atomic_init(&copy->refs, 1);
+            for (int c = 0; c < COW_CHILDREN; ++c) {
+                copy->nodes[c] = node->nodes[c];
+                if (d > 1) atomic_fetch_add(&node->nodes[c]->refs, 1);
+                else atomic_fetch_add(&node->blocks[c]->refs, 1);
+            }
+            release_cow_node(node, d);
+            *link = node = copy;
+        }
+        if (d > 1) {
+            link = &node->nodes[cow_child(x, y, d)];
+            continue;
+        }
+
+        Cow_Block ** block_link = &node->blocks[cow_child(x, y, 1)];
+        Cow_Block * block = *block_link;
+        if (atomic_load(&block->refs) > 1) {
+            Cow_Block * copy = malloc(sizeof(Cow_Block));
+            if (!copy) return NULL;
+            atomic_init(&copy->refs, 1);
+            memcpy(copy->tiles, block->tiles, sizeof(copy->tiles));
+            if (atomic_fetch_sub(&block->refs, 1) == 1) free(block);
+            *block_link = block = copy;
+        }
+        return &block->tiles[cow_child(x, y, 0)];
+    }
+    return NULL;
+}
+
+// Sets a tile, copying only what is shared and only if it changes.
+// Returns false if out of memory, leaving the map as it was.
+bool set_cow_tile(Cow_Map * map, int x, int y, Tile tile) {
+    if (cow_tile(map, x, y) == tile) return true;
+    Tile * target = cow_tile_for_write(map, x, y);
+    if (!target) return false;
+    *target = tile;
+    return true;
+}
+
+// Makes a map with the same tiles as 'from'. Returns false if out of memory.
+bool cow_from_map(Cow_Map * map, Map * from) {
+    if (!make_cow_map(map, from->width, from->height, 0)) return false;
+    for (int y = 0; y < from->height; ++y) {
+        for (int x = 0; x < from->width; ++x) {
+            if (!set_cow_tile(map, x, y, *map_tile(from, x, y))) {
+                free_cow_map(map);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool cow_from_level(Cow_Map * map, Level level) {
+    Map from = level_as_map(level);
+    return cow_from_map(map, &from);
+}
+
+void cow_to_level(Cow_Map * map, Level level) {
+    for (int y = 0; y < LEVEL_SIZE; ++y) {
+        for (int x = 0; x < LEVEL_SIZE; ++x) {
+            level[x + y * LEVEL_SIZE] = cow_tile(map, x, y);
+        }
+    }
+}
+
+#ifndef NO_MAIN
+
+// Keeps a number of branches, and again and again forks a random one,
+// changes a few tiles of the fork, and puts it in place of another random
+// branch, in the way a search would. The same is done with whole copies of
+// the map, and the branches are checked to be the same at the end.
+int main(int argument_count, char ** arguments) {
+    int size = argument_count > 1 ? atoi(arguments[1]) : 1024;
+    int fork_count = argument_count > 2 ? atoi(arguments[2]) : 20000;
+    int branch_count = 64;
+    int changes = 4;
+    size = MAX(1, size);
+
+    Map map = make_map(size, size);
+    if (!map.tiles) return 1;
+    for (int i = 0; i < size * size; ++i) map.tiles[i] = chance(0.4f) ? BIT(WALL) : BIT(FLOOR);
+
+    Cow_Map cow_branches[branch_count];
+    Tile * copy_branches[branch_count];
+    for (int b = 0; b < branch_count; ++b) {
+        copy_branches[b] = malloc(sizeof(Tile) * size * size);
+        if (!copy_branches[b]) return 1;
+        memcpy(copy_branches[b], map.tiles, sizeof(Tile) * size * size);
+    }
+    if (!cow_from_map(&cow_branches[0], &map)) return 1;
+    for (int b = 1; b < branch_count; ++b) cow_branches[b] = fork_cow_map(&cow_branches[0]);
+
+    u64 seed = random_u64();
+    reset_seed(seed, 0);
+    double start = seconds_now();
+    for (int f = 0; f < fork_count; ++f) {
+        int from = random_int_range(0, branch_count - 1);
+        int to = random_int_range(0, branch_count - 1);
+        Cow_Map fork = fork_cow_map(&cow_branches[from]);
+        for (int c = 0; c < changes; ++c) {
+            int x = random_int_range(0, size - 1);
+            int y = random_int_range(0, size - 1);
+            if (!set_cow_tile(&fork, x, y, (Tile)random_int_range(1, 511))) return 1;
+        }
+        free_cow_map(&cow_branches[to]);
+        cow_branches[to] = fork;
+    }
+    double cow_seconds = seconds_now() - start;
+
+    reset_seed(seed, 0);
+    Tile * spare = malloc(sizeof(Tile) * size * size);
+    if (!spare) return 1;
+    start = seconds_now();
+    for (int f = 0; f < fork_count; ++f) {
+        int from = random_int_range(0, branch_count - 1);
+        int to = random_int_range(0, branch_count - 1);
+        memcpy(spare, copy_branches[from], sizeof(Tile) * size * size);
+        for (int c = 0; c < changes; ++c) {
+            int x = random_int_range(0, size - 1);
+            int y = random_int_range(0, size - 1);
+            spare[x + y * size] = (Tile)random_int_range(1, 511);
+        }
+        Tile * old = copy_branches[to];
+        copy_branches[to] = spare;
+        spare = old;
+    }
+    double copy_seconds = seconds_now() - start;
+
+    int wrong = 0;
+    for (int b = 0; b < branch_count; ++b) {
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) {
+                if (cow_tile(&cow_branches[b], x, y) != copy_branches[b][x + y * size]) ++wrong;
+            }
+        }
+    }
+
+    printf("%d forks of a %d by %d map, changing %d tiles each, keeping %d branches.\n",
+        fork_count, size, size, changes, branch_count);
+    printf("Copy on write: %.3f s (%.2f us each). Whole copies: %.3f s (%.2f us each).\n",
+        cow_seconds, cow_seconds / fork_count * 1e6, copy_seconds, copy_seconds / fork_count * 1e6);
+    printf("Each change copies at most %zu bytes, rather than %zu.\n",
+        cow_branches[0].depth * sizeof(Cow_Node) + sizeof(Cow_Block), sizeof(Tile) * size * size);
+    printf("%s\n", wrong ? "Branches DIFFER." : "Branches match.");
+
+    for (int b = 0; b < branch_count; ++b) {
+        free_cow_map(&cow_branches[b]);
+        free(copy_branches[b]);
+    }
+    free(spare);
+    free_map(&map);
+    return wrong != 0;
+}
+
+#endif
@@ -0,0 +1,186 @@
+/*
+    delta.c
+    Compact record of every step of a game, for replays and analytics.
+
+    Only a few tiles change each step, so rather than storing the whole level,
+    each step is stored as a list of changed tiles. A change is the distance
+    from the previously changed tile, then the old and new bits of the tile,
+    each written as a variable-length integer; a typical step takes well under
+    twenty bytes. A full copy of the level is kept every KEYFRAME_INTERVAL steps
+    so that any step can be found without replaying the whole game.
+*/
+
+#pragma once
+
+#include "common.c"
+
+#define KEYFRAME_INTERVAL 64
+
+typedef struct {
+    // The state of the level after this many steps.
+    int step;
+    // Where the encoded deltas following this keyframe begin.
+    size_t offset;
+    Level level;
+} Delta_Keyframe;
+
+typedef struct {
+    u8 * bytes;
+    size_t byte_count, byte_capacity;
+    Delta_Keyframe * keyframes;
+    int keyframe_count, keyframe_capacity;
+    int step_count;
+} Delta_Log;
+
+void add_keyframe(Delta_Log * log, Level level) {
+    if (log->keyframe_count == log->keyframe_capacity) {
+        log->keyframe_capacity = MAX(8, log->keyframe_capacity * 2);
+        log->keyframes = realloc(log->keyframes, sizeof(Delta_Keyframe) * log->keyframe_capacity);
+    }
+    Delta_Keyframe * keyframe = &log->keyframes[log->keyframe_count++];
+    keyframe->step = log->step_count;
+    keyframe->offset = log->byte_count;
+    memcpy(keyframe->level, level, sizeof(Level));
+}
+
+void put_varint(Delta_Log * log, u32 value) {
+    if (log->byte_count + 5 > log->byte_capacity) {
+        log->byte_capacity = MAX(1024, log->byte_capacity * 2);
+        log->bytes = realloc(log->bytes, log->byte_capacity);
+    }
+    // Seven bits per byte, with the top bit set on all but the last byte.
+    while (value >= 0x80) {
+        log->bytes[log->byte_count++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    log->bytes[log->byte_count++] = value;
+}
+
+// Reads a value written by put_varint, moving 'offset' past it.
+// Returns false if it runs past 'byte_count'.
+bool get_varint(u8 * bytes, size_t byte_count, size_t * offset, u32 * value) {
+    *value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (*offset >= byte_count) return false;
+        u8 byte = bytes[(*offset)++];
+        *value |= (u32)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) break;
+    }
+    return true;
+}
+
+// Starts a new log from the state of a level before any steps are taken.
+void begin_delta_log(Delta_Log * log, Level level) {
+    *log = (Delta_Log){0};
+    add_keyframe(log, level);
+}
+
+void free_delta_log(Delta_Log * log) {
+    free(log->bytes);
+    free(log->keyframes);
+    *log = (Delta_Log){0};
+}
+
+// Records the changes made to a level by a single step.
+void record_step(Delta_Log * log, Level before, Level after) {
+    int change_count = 0;
+    for (int i = 0; i < LEVEL_SIZE * LEVEL_SIZE; ++i) {
+        if (before[i] != after[i]) ++change_count;
+    }
+
+    put_varint(log, change_count);
+    int previous = 0;
+    for (int i = 0; i < LEVEL_SIZE * LEVEL_SIZE; ++i) {
+        if (before[i] != after[i]) {
+            put_varint(log, i - previous);
+            put_varint(log, before[i]);
+            put_varint(log, after[i]);
+            previous = i;
+        }
+    }
+
+    ++log->step_count;
+    if (log->step_count % KEYFRAME_INTERVAL == 0) add_keyframe(log, after);
+}
+
+// Applies the step encoded at 'offset' to a level, moving 'offset' past it.
+// Returns false if the step is cut short, changes a tile outside the level,
+// or finds a tile that was not as it was when the step was recorded.
+bool apply_step(Delta_Log * log, size_t * offset, Level level) {
+    u32 change_count, index = 0;
+    if (!get_varint(log->bytes, log->byte_count, offset, &change_count)) return false;
+    for (u32 i = 0; i < change_count; ++i) {
+        u32 distance, before, after;
+        if (!get_varint(log->bytes, log->byte_count, offset, &distance)
+                || !get_varint(log->bytes, log->byte_count, offset, &before)
+                || !get_varint(log->bytes, log->byte_count, offset, &after)) return false;
+        if (distance >= LEVEL_SIZE * LEVEL_SIZE - index) return false;
+        index += distance;
+        if (level[index] != before) return false;
+        level[index] = after;
+    }
+    return true;
+}
+
+// Rebuilds the state of the level after the given number of steps.
+// Returns false if the log does not reach that far.
+bool seek_delta_log(Delta_Log * log, int step, Level level) {
+    if (step < 0 || step > log->step_count || log->keyframe_count == 0) return false;
+
+    // Find the last keyframe at or before the step.
+    int low = 0, high = log->keyframe_count - 1;
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+        if (log->keyframes[middle].step <= step) low = middle;
+        else high = middle - 1;
+    }
+
+    Delta_Keyframe * keyframe = &log->keyframes[low];
+    memcpy(level, keyframe->level, sizeof(Level));
+    size_t offset = keyframe->offset;
+    for (int s = keyframe->step; s < step; ++s) {
+        if (!apply_step(log, &offset, level)) return false;
+    }
+    return true;
+}
+
+// The file holds the starting level and the encoded steps.
+// Keyframes are rebuilt when it is read back in.
+bool write_delta_log(FILE * file, Delta_Log * log) {
+    u32 header[3] = { 0x474f4c44, log->step_count, log->byte_count };
+    if (log->keyframe_count == 0) return false;
+    return fwrite(header, sizeof(header), 1, file)
+        && write_level(file, log->keyframes[0].level)
+        && fwrite(log->bytes, 1, log->byte_count, file) == log->byte_count;
+}
+
+// Returns false if the file is not a log, or is cut short or damaged.
+bool read_delta_log(FILE * file, Delta_Log * log) {
+    u32 header[3];
+    Level level;
+    if (!fread(header, sizeof(header), 1, file) || header[0] != 0x474f4c44) return false;
+    if (!load_level(file, level)) return false;
+
+    begin_delta_log(log, level);
+    log->byte_capacity = (size_t)header[2] + 5;
+    log->bytes = malloc(log->byte_capacity);
+    if (!log->bytes || fread(log->bytes, 1, header[2], file) != header[2]) {
+        free_delta_log(log);
+        return false;
+    }
+    log->byte_count = header[2];
+
+    size_t offset = 0;
+    for (u32 step = 1; step <= header[1]; ++step) {
+        if (!apply_step(log, &offset, level)) {
+            free_delta_log(log);
+            return false;
+        }
+        log->step_count = step;
+        if (step % KEYFRAME_INTERVAL == 0) {
+            add_keyframe(log, level);
+            log->keyframes[log->keyframe_count - 1].offset = offset;
+        }
+    }
+    return true;
+}
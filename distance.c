@@ -0,0 +1,165 @@
+/*
+    distance.c
+    Distance from every tile to the nearest wall.
+
+    Used to find rooms (tiles far from walls are in the middle of rooms), to
+    measure how wide corridors are, and to keep enemies away from tight spots.
+    The edge of the map counts as wall.
+
+    Distances are exact, not rounded to steps, using the method of Felzenszwalb
+    and Huttenlocher. First each tile finds how far up or down its column the
+    nearest wall is. That is done a whole row at a time, going down the map
+    and then back up, 4 tiles at once with SSE2. Then along each row, the
+    nearest wall of each tile is whichever column gives the lowest
+    (column distance squared + row distance squared), which is found for the
+    whole row in one sweep by keeping the lower envelope of the parabolas.
+
+    The result is kept with the map, so it is only worked out once however
+    many generators and metrics use it, until the walls change.
+
+    See segment.c for a program that uses it.
+*/
+
+#pragma once
+
+#include "common.c"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Gets a row of tiles, copying it into 'scratch' if the map is stored in blocks.
+Tile * map_row(Map * map, int y, Tile * scratch) {
+    if (map->block_shift == 0) return map_tile(map, 0, y);
+    for (int x = 0; x < map->width; ++x) scratch[x] = *map_tile(map, x, y);
+    return scratch;
+}
+
+// Moves one row down (or up) the map: each tile's distance to the nearest
+// wall in its column is one more than the row before's, or 0 on a wall.
+void step_column_distance(Tile * row, float * before, float * out, int width) {
+    int x = 0;
+#if defined(__x86_64__)
+    __m128i wall_bit = _mm_set1_epi16(BIT(WALL));
+    __m128 one = _mm_set1_ps(1.0f);
+    for (; x + 8 <= width; x += 8) {
+        __m128i tiles = _mm_loadu_si128((__m128i *)&row[x]);
+        // All ones in each 16 bit lane that is a wall, widened to 32 bits.
+        __m128i walls = _mm_cmpeq_epi16(_mm_and_si128(tiles, wall_bit), wall_bit);
+        __m128 walls_low  = _mm_castsi128_ps(_mm_unpacklo_epi16(walls, walls));
+        __m128 walls_high = _mm_castsi128_ps(_mm_unpackhi_epi16(walls, walls));
+        __m128 low  = _mm_add_ps(_mm_loadu_ps(&before[x]), one);
+        __m128 high = _mm_add_ps(_mm_loadu_ps(&before[x + 4]), one);
+        _mm_storeu_ps(&out[x],     _mm_andnot_ps(walls_low, low));
+        _mm_storeu_ps(&out[x + 4], _mm_andnot_ps(walls_high, high));
+    }
+#endif
+    for (; x < width; ++x) out[x] = (row[x] & BIT(WALL)) ? 0 : before[x] + 1;
+}
+
+// Keeps the lower of each tile's distance and one more than the row after's.
+void min_column_distance(float * after, float * out, int width) {
+    int x = 0;
+#if defined(__x86_64__)
+    __m128 one = _mm_set1_ps(1.0f);
+    for (; x + 4 <= width; x += 4) {
+        __m128 from_after = _mm_add_ps(_mm_loadu_ps(&after[x]), one);
+        _mm_storeu_ps(&out[x], _mm_min_ps(_mm_loadu_ps(&out[x]), from_after));
+    }
+#endif
+    for (; x < width; ++x) out[x] = MIN(out[x], after[x] + 1);
+}
+
+// Turns a row of distances to the nearest wall in each column into exact
+// distances to the nearest wall anywhere. 'nearest' and 'starts' are space
+// for 'width' ints and 'width + 1' floats.
+void row_wall_distance(float * column, float * out, int width, int * nearest, float * starts) {
+    // Each column gives a parabola (x - column)^2 + column distance^2 over
+    // the row, and the lowest one at each x is the nearest wall. Build the
+    // lower envelope of them: nearest[k] is the column of the k-th parabola
+    // in it, which is the lowest from starts[k] to starts[k + 1].
+    // Worked out in doubles, as the squares are too big for floats to hold
+    // exactly on wide maps.
+    #define PARABOLA_CROSSING(q, v) \
+        (((double)column[q] * column[q] + (double)(q) * (q)) - ((double)column[v] * column[v] + (double)(v) * (v))) / (2.0 * ((q) - (v)))
+    int k = 0;
+    nearest[0] = 0;
+    starts[0] = -FLT_MAX;
+    starts[1] = FLT_MAX;
+    for (int q = 1; q < width; ++q) {
+        float s = PARABOLA_CROSSING(q, nearest[k]);
+        // The last parabola is never lower than this one anywhere, so drop it.
+        while (s <= starts[k]) {
+            --k;
+            s = PARABOLA_CROSSING(q, nearest[k]);
+        }
+        ++k;
+        nearest[k] = q;
+        starts[k] = s;
+        starts[k + 1] = FLT_MAX;
+    }
+    #undef PARABOLA_CROSSING
+
+    // Read the envelope out, and also keep the distance to the edges of the
+    // map at either end of the row, which count as wall.
+    k = 0;
+    for (int x = 0; x < width; ++x) {
+        while (starts[k + 1] < x) ++k;
+        int v = nearest[k];
+        float squared = (float)(x - v) * (x - v) + column[v] * column[v];
+        float edge = MIN(x + 1, width - x);
+        out[x] = sqrtf(MIN(squared, edge * edge));
+    }
+}
+
+// Works out the distance from every tile to the nearest wall, into 'out',
+// which holds one row after another, whatever the layout of the map.
+// Returns false if there was not enough memory.
+bool wall_distance_transform(Map * map, float * out) {
+    int width = map->width, height = map->height;
+    Tile * scratch = malloc(sizeof(Tile) * width);
+    float * edge = malloc(sizeof(float) * width);
+    int * nearest = malloc(sizeof(int) * width);
+    float * starts = malloc(sizeof(float) * (width + 1));
+    bool ok = scratch && edge && nearest && starts;
+    if (ok) {
+        // Above the first row and below the last are edges, which count as wall.
+        for (int x = 0; x < width; ++x) edge[x] = 0;
+        for (int y = 0; y < height; ++y) {
+            float * before = y > 0 ? &out[(size_t)(y - 1) * width] : edge;
+            step_column_distance(map_row(map, y, scratch), before, &out[(size_t)y * width], width);
+        }
+        for (int y = height - 1; y >= 0; --y) {
+            float * after = y < height - 1 ? &out[(size_t)(y + 1) * width] : edge;
+            min_column_distance(after, &out[(size_t)y * width], width);
+        }
+        float * column = malloc(sizeof(float) * width);
+        ok = column;
+        for (int y = 0; ok && y < height; ++y) {
+            memcpy(column, &out[(size_t)y * width], sizeof(float) * width);
+            row_wall_distance(column, &out[(size_t)y * width], width, nearest, starts);
+        }
+        free(column);
+    }
+    free(scratch);
+    free(edge);
+    free(nearest);
+    free(starts);
+    return ok;
+}
+
+// Gets the distance from every tile to the nearest wall, one row after
+// another. It is worked out the first time, and kept with the map after that,
+// until forget_wall_distance is called. Returns NULL if there was not enough memory.
+float * map_wall_distance(Map * map) {
+    if (map->wall_distance) return map->wall_distance;
+    map->wall_distance = malloc(sizeof(float) * map->width * map->height);
+    if (!map->wall_distance) return NULL;
+    if (!wall_distance_transform(map, map->wall_distance)) forget_wall_distance(map);
+    return map->wall_distance;
+}
+
+float wall_distance(Map * map, int x, int y) {
+    float * distance = map_wall_distance(map);
+    return distance ? distance[x + (size_t)y * map->width] : 0;
+}
@@ -6,48 +6,8 @@
     Jan 2018
 */
 
-#include <SDL2/SDL.h>
-#include "common.c"
-
-SDL_Window * window = NULL;
-SDL_Renderer * renderer = NULL;
-SDL_Texture * sprite_texture = NULL;
-
-void draw_sprite(int entity_index, int tile_x, int tile_y) {
-    SDL_Rect sprite_rect = {
-        entity_index * SPRITE_SIZE, 0,
-        SPRITE_SIZE, SPRITE_SIZE
-    };
-    SDL_Rect screen_rect = {
-        tile_x * SPRITE_SIZE, tile_y * SPRITE_SIZE,
-        SPRITE_SIZE, SPRITE_SIZE
-    };
-    SDL_RenderCopy(renderer, sprite_texture, &sprite_rect, &screen_rect);
-}
-
-// Draws a number on screen using a bitmap font.
-void draw_number(int number, int screen_x, int screen_y) {
-    char number_string[64];
-    snprintf(number_string, 64, "%d", number);
-    for (int i = 0; i < 64 && number_string[i]; ++i) {
-        int offset = SPRITE_SIZE * 10;
-        int char_offset = (number_string[i] - '0') * 8;
-        SDL_Rect sprite_rect = { offset + char_offset, 0, 8, 8 };
-        SDL_Rect screen_rect = { screen_x + i * 8, screen_y, 8, 8 };
-        SDL_RenderCopy(renderer, sprite_texture, &sprite_rect, &screen_rect);
-    }
-}
-
-void draw_level(Level level) {
-    for (int y = 0; y < LEVEL_SIZE; ++y) {
-        for (int x = 0; x < LEVEL_SIZE; ++x) {
-            Tile tile = level[x + y * LEVEL_SIZE];
-            for (int bit = 1; bit <= ENTITY_TYPE_COUNT; ++bit) {
-                if (tile & BIT(bit)) draw_sprite(bit, x, y);
-            }
-        }
-    }
-}
+#include "graphics.c"
+#include "profiler.c"
 
 void fill_level(Level level, int entity) {
     for (int y = 0; y < LEVEL_SIZE; ++y) {
@@ -91,12 +51,13 @@ int main(int argument_count, char ** arguments) {
     Level level = {0};
     // load_level(stdin, level);
 
-    SDL_Init(SDL_INIT_VIDEO);
-    window = SDL_CreateWindow("",
-        SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-        LEVEL_SIZE * SPRITE_SIZE, LEVEL_SIZE * SPRITE_SIZE, 0);
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC);
-    sprite_texture = SDL_CreateTextureFromSurface(renderer, SDL_LoadBMP("sheet.bmp"));
+    if (!init_graphics()) {
+        fprintf(stderr, "Could not start graphics: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    static Profiler profiler;
+    bool show_profiler = false;
 
     int tx = 0;
     int ty = 0;
@@ -104,6 +65,9 @@ int main(int argument_count, char ** arguments) {
     int steps = 0;
 
     while (true) {
+        u64 frame_start = profile_start();
+        u64 update_start = profile_start();
+
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) return 0;
@@ -138,6 +102,8 @@ int main(int argument_count, char ** arguments) {
                     tile_type = 9;
                 } else if (sc == SDL_SCANCODE_0) {
                     tile_type = 0;
+                } else if (sc == SDL_SCANCODE_F3) {
+                    show_profiler = !show_profiler;
                 }
             }
             if (event.type == SDL_MOUSEMOTION) {
@@ -164,10 +130,16 @@ int main(int argument_count, char ** arguments) {
             }
         }
 
+        bool completable = level_is_completable(level);
+        add_sample(&profiler.update, profile_end(update_start));
+
         SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
         SDL_RenderClear(renderer);
 
+        draw_calls = 0;
+        u64 draw_start = profile_start();
         draw_level(level);
+        add_sample(&profiler.draw, profile_end(draw_start));
 
         SDL_SetTextureAlphaMod(sprite_texture, 150 + 50 * sinf(SDL_GetTicks() * 0.01f));
         draw_sprite(tile_type, tx, ty);
@@ -180,10 +152,14 @@ int main(int argument_count, char ** arguments) {
         draw_number(tx, 0, 0);
         draw_number(ty, 32, 0);
 
-        draw_number(level_is_completable(level), 0, 8);
+        draw_number(completable, 0, 8);
         draw_number(steps, 0, 16);
 
+        add_sample(&profiler.draw_calls, draw_calls);
+        if (show_profiler) draw_profiler(&profiler);
+
         SDL_Delay(3);
         SDL_RenderPresent(renderer);
+        add_sample(&profiler.frame, profile_end(frame_start));
     }
 }
@@ -6,194 +6,103 @@
     Jan 2018
 */
 
-// This program uses SDL2 to be cross-platform.
-#include <SDL2/SDL.h>
-#include "common.c"
-
-// Used to get graphics on screen.
-SDL_Window * window = NULL;
-SDL_Renderer * renderer = NULL;
-SDL_Texture * sprite_texture = NULL;
-
-// Stats from playing the game
-int gold_collected = 0;
-int enemies_killed = 0;
-int steps_taken = 0;
-
-// Draws a sprite using its ID.
-// The coordinates correspond to tiles, not pixels.
-void draw_sprite(int entity_id, int tile_x, int tile_y) {
-    SDL_Rect sprite_rect = {
-        entity_id * SPRITE_SIZE, 0,
-        SPRITE_SIZE, SPRITE_SIZE
-    };
-    SDL_Rect screen_rect = {
-        tile_x * SPRITE_SIZE, tile_y * SPRITE_SIZE,
-        SPRITE_SIZE, SPRITE_SIZE
-    };
-    SDL_RenderCopy(renderer, sprite_texture, &sprite_rect, &screen_rect);
-}
-
-// Draws an entire level.
-void draw_level(Level level) {
-    for (int y = 0; y < LEVEL_SIZE; ++y) {
-        for (int x = 0; x < LEVEL_SIZE; ++x) {
-            Tile tile = level[x + y * LEVEL_SIZE];
-            // Check each bit of the tile, and draw the entity if
-            // the corresponding bit is set.
-            for (int bit = 1; bit <= ENTITY_TYPE_COUNT; ++bit) {
-                if (tile & BIT(bit)) draw_sprite(bit, x, y);
-            }
-        }
+#include "graphics.c"
+#include "profiler.c"
+#include "rules.c"
+
+#define NO_MAIN
+#include "validate.c"
+
+// Runs on its own thread, writing telemetry out until told to stop.
+typedef struct {
+    Telemetry * telemetry;
+    FILE * file;
+    bool csv;
+    _Atomic bool running;
+} Telemetry_Flusher;
+
+int flush_telemetry_thread(void * data) {
+    Telemetry_Flusher * flusher = data;
+    while (atomic_load(&flusher->running)) {
+        flush_telemetry(flusher->telemetry, flusher->file, flusher->csv);
+        SDL_Delay(50);
     }
+    // Catch anything pushed after the last flush.
+    flush_telemetry(flusher->telemetry, flusher->file, flusher->csv);
+    return 0;
 }
 
-// Updates the entire level, stepping the player in the given direction.
-// Returns true if the game has ended for any reason.
-bool update_level(Level level, int direction) {
-    bool game_over = false;
-
-    // Create an empty level that will replace the old one.
-    Level updated_level = {0};
-
-    // Copy over all entities that are unaffected by updates.
-    for (int i = 0; i < LEVEL_SIZE * LEVEL_SIZE; ++i) {
-        updated_level[i] |= level[i] & STATIC_ENTITIES;
-    }
-
-    // If a key still exists in the stage, then it has not been found.
-    bool key_has_been_collected = true;
-
-    // First pass through level handles dynamic entities.
-    for (int y = 0; y < LEVEL_SIZE; ++y) {
-        for (int x = 0; x < LEVEL_SIZE; ++x) {
-            Tile tile = level[x + y * LEVEL_SIZE];
-
-            if (tile & BIT(ENEMY)) {
-                // Move the enemy in a random direction.
-                int new_x = x, new_y = y;
-                int direction = random_int_range(1, 6);
-                if (direction == UP)    --new_y; else
-                if (direction == DOWN)  ++new_y; else
-                if (direction == LEFT)  --new_x; else
-                if (direction == RIGHT) ++new_x;
-
-                // Only succeed if that tile is not solid.
-                if ((level[new_x + new_y * LEVEL_SIZE] & SOLID_ENTITIES) == 0) {
-                    updated_level[new_x + new_y * LEVEL_SIZE] |= BIT(ENEMY);
-                } else {
-                    updated_level[x + y * LEVEL_SIZE] |= BIT(ENEMY);
-                }
-            }
-
-            if (tile & BIT(PLAYER)) {
-                // If the player is already standing on a spider, kill it.
-                if (updated_level[x + y * LEVEL_SIZE] & BIT(ENEMY)) {
-                    updated_level[x + y * LEVEL_SIZE] ^= BIT(ENEMY);
-                    ++enemies_killed;
-                }
-
-                // Attempt to move to the new tile.
-                int new_x = x, new_y = y;
-                if (direction == UP)    --new_y; else
-                if (direction == DOWN)  ++new_y; else
-                if (direction == LEFT)  --new_x; else
-                if (direction == RIGHT) ++new_x;
-
-                Tile new_tile = level[new_x + new_y * LEVEL_SIZE];
-
-                // Only succeed if that tile is not solid.
-                if ((new_tile & SOLID_ENTITIES) == 0) {
-                    updated_level[new_x + new_y * LEVEL_SIZE] |= BIT(PLAYER);
-
-                    // Collect any collectables on the new tile.
-                    if (new_tile & BIT(GOLD)) {
-                        level[new_x + new_y * LEVEL_SIZE] ^= BIT(GOLD);
-                        ++gold_collected;
-                    }
-                    if (new_tile & BIT(KEY)) {
-                        level[new_x + new_y * LEVEL_SIZE] ^= BIT(KEY);
-                    }
-
-                    // Kill any enemies on the new tile.
-                    if (new_tile & BIT(ENEMY)) {
-                        level[new_x + new_y * LEVEL_SIZE] ^= BIT(ENEMY);
-                        ++enemies_killed;
-                    }
-
-                    // End the game if the player reaches the exit and there
-                    // is not a lock on it.
-                    if (new_tile & BIT(EXIT) && (new_tile & BIT(LOCK)) == 0) {
-                        game_over = true;
-                    }
-
-                    // End the game if the player steps onto spikes.
-                    if (new_tile & BIT(SPIKES)) {
-                        game_over = true;
-                    }
-                } else {
-                    // Place the player onto their original tile in the updated
-                    // level if they did not move in any direction.
-                    updated_level[x + y * LEVEL_SIZE] |= BIT(PLAYER);
-                }
-            }
-        }
+int main(int argument_count, char ** arguments) {
+    // Load a level.
+    Level level = {0};
+    if (!load_level(stdin, level)) {
+        fprintf(stderr, "Could not read a level.\n");
+        return 1;
     }
-
-    // Second pass handles collectables, as they may have been affected by the first pass.
-    for (int y = 0; y < LEVEL_SIZE; ++y) {
-        for (int x = 0; x < LEVEL_SIZE; ++x) {
-            Tile tile = level[x + y * LEVEL_SIZE];
-            if (tile & BIT(GOLD)) updated_level[x + y * LEVEL_SIZE] |= BIT(GOLD);
-            if (tile & BIT(KEY)) {
-                key_has_been_collected = false;
-                updated_level[x + y * LEVEL_SIZE] |= BIT(KEY);
-            }
-        }
+    int problems = level_problems(level);
+    if (problems) {
+        fprintf(stderr, "The level is not well formed:\n");
+        print_level_problems(stderr, level, problems);
+        return 1;
     }
 
-    // Final pass handles the lock.
-    for (int y = 0; y < LEVEL_SIZE; ++y) {
-        for (int x = 0; x < LEVEL_SIZE; ++x) {
-            Tile tile = level[x + y * LEVEL_SIZE];
-            if (tile & BIT(LOCK) && !key_has_been_collected) {
-                updated_level[x + y * LEVEL_SIZE] |= BIT(LOCK);
-            }
-        }
+    // Options:
+    //   -r file  record a replay of the game into the file.
+    //   -t file  write telemetry into the file, as CSV if it ends in '.csv'.
+    //   -p       show the profiler overlay (F3 toggles it while playing).
+    char * replay_path = NULL;
+    char * telemetry_path = NULL;
+    bool show_profiler = false;
+    for (int i = 1; i < argument_count; ++i) {
+        if (strcmp(arguments[i], "-p") == 0) show_profiler = true;
+        if (i + 1 == argument_count) break;
+        if (strcmp(arguments[i], "-r") == 0) replay_path = arguments[++i];
+        else if (strcmp(arguments[i], "-t") == 0) telemetry_path = arguments[++i];
     }
 
-    // Overwrite the original level with the update.
-    for (int i = 0; i < LEVEL_SIZE * LEVEL_SIZE; ++i) {
-        level[i] = updated_level[i];
+    Game game = {0};
+    Delta_Log replay;
+    if (replay_path) {
+        begin_delta_log(&replay, level);
+        game.delta_log = &replay;
     }
 
-    // The update is fully carried out, even when it is known earlier on that
-    // the player has done something to end the game, to make sure the player
-    // sees the final state of the game represented on screen at the end.
-    return game_over;
-}
-
-int main(int argument_count, char ** arguments) {
-    // Load a level.
-    Level level = {0};
-    load_level(stdin, level);
-
     // Set up everything needed for graphics.
-    SDL_Init(SDL_INIT_VIDEO);
-    window = SDL_CreateWindow("",
-        SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-        LEVEL_SIZE * SPRITE_SIZE, LEVEL_SIZE * SPRITE_SIZE, 0);
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC);
-    sprite_texture = SDL_CreateTextureFromSurface(renderer,
-        SDL_LoadBMP("sheet.bmp"));
+    if (!init_graphics()) {
+        fprintf(stderr, "Could not start graphics: %s\n", SDL_GetError());
+        return 1;
+    }
 
     // Seed the random number generator.
     set_seed(~SDL_GetTicks(), ~SDL_GetPerformanceCounter());
 
+    // Start writing telemetry in the background.
+    static Telemetry events;
+    Telemetry_Flusher flusher = {0};
+    SDL_Thread * flusher_thread = NULL;
+    if (telemetry_path) {
+        size_t length = strlen(telemetry_path);
+        flusher.telemetry = &events;
+        flusher.file = fopen(telemetry_path, "wb");
+        flusher.csv = length >= 4 && strcmp(telemetry_path + length - 4, ".csv") == 0;
+        atomic_store(&flusher.running, true);
+        if (flusher.file) {
+            write_telemetry_header(flusher.file, flusher.csv);
+            game.telemetry = &events;
+            flusher_thread = SDL_CreateThread(flush_telemetry_thread, "telemetry", &flusher);
+        } else {
+            fprintf(stderr, "Could not open %s for telemetry.\n", telemetry_path);
+        }
+    }
+
     bool game_over = false;
+    float frame_time = 0;
+    static Profiler profiler;
 
     // Begin the frame loop.
     while (!game_over) {
+        u64 frame_start = profile_start();
+
         // Parse all events that have occurred.
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
@@ -210,18 +119,47 @@ int main(int argument_count, char ** arguments) {
                 // Set direction to an arbitrary non-zero value to cause an update,
                 // but not cause any movement to occur within update_level.
                 if (sc == SDL_SCANCODE_SPACE) direction = ~0;
+                if (sc == SDL_SCANCODE_F3) show_profiler = !show_profiler;
                 if (direction) {
-                    game_over = update_level(level, direction);
-                    ++steps_taken;
+                    u64 update_start = profile_start();
+                    game_over = update_level(level, direction, &game);
+                    add_sample(&profiler.update, profile_end(update_start));
+                    ++game.steps_taken;
+                    if (game.telemetry) {
+                        int px = 0, py = 0;
+                        find_player(level, &px, &py);
+                        record_event(game.telemetry,
+                            (Telemetry_Event){ game.steps_taken, EVENT_STEP, px, py, frame_time });
+                    }
                 }
             }
         }
         SDL_RenderClear(renderer);
+        draw_calls = 0;
+        u64 draw_start = profile_start();
         draw_level(level);
+        add_sample(&profiler.draw, profile_end(draw_start));
+        add_sample(&profiler.draw_calls, draw_calls);
+        if (show_profiler) draw_profiler(&profiler);
         SDL_Delay(10);
         SDL_RenderPresent(renderer);
+
+        float frame_micros = profile_end(frame_start);
+        add_sample(&profiler.frame, frame_micros);
+        frame_time = frame_micros / 1000.0f;
     }
 
+    // Stop the telemetry thread, letting it write out what is left.
+    if (flusher_thread) {
+        atomic_store(&flusher.running, false);
+        SDL_WaitThread(flusher_thread, NULL);
+        if (atomic_load(&events.dropped)) {
+            fprintf(stderr, "%llu telemetry events were dropped.\n",
+                (unsigned long long)atomic_load(&events.dropped));
+        }
+    }
+    if (flusher.file) fclose(flusher.file);
+
     // The game is now over, so show a message with the results.
     char message[512];
     snprintf(message, 512,
@@ -231,9 +169,9 @@ int main(int argument_count, char ** arguments) {
         "Gold Collected: %d\n"
         "Enemies Killed: %d\n"
         "Steps Taken: %d",
-        gold_collected,
-        enemies_killed,
-        steps_taken
+        game.gold_collected,
+        game.enemies_killed,
+        game.steps_taken
     );
 
     // Show it as a pop-up box.
@@ -241,4 +179,12 @@ int main(int argument_count, char ** arguments) {
 
     // And print it to stdout.
     printf("Game Over!\n%s\n", message);
+
+    if (game.delta_log) {
+        FILE * file = fopen(replay_path, "wb");
+        if (!file || !write_delta_log(file, game.delta_log)) {
+            fprintf(stderr, "Could not write replay to %s.\n", replay_path);
+        }
+        if (file) fclose(file);
+    }
 }
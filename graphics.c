@@ -0,0 +1,78 @@
+/*
+    graphics.c
+    Drawing code shared between the game and the editor.
+*/
+
+#pragma once
+
+// This program uses SDL2 to be cross-platform.
+#include <SDL2/SDL.h>
+#include "common.c"
+
+// Used to get graphics on screen.
+SDL_Window * window = NULL;
+SDL_Renderer * renderer = NULL;
+SDL_Texture * sprite_texture = NULL;
+
+// Number of sprites drawn since this was last reset.
+int draw_calls = 0;
+
+// Opens a window the size of a level, and loads the sprite sheet.
+// Falls back to the software renderer if there is no accelerated one,
+// for example when running with SDL_VIDEODRIVER=dummy.
+bool init_graphics(void) {
+    if (SDL_Init(SDL_INIT_VIDEO) != 0) return false;
+    window = SDL_CreateWindow("",
+        SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+        LEVEL_SIZE * SPRITE_SIZE, LEVEL_SIZE * SPRITE_SIZE, 0);
+    if (!window) return false;
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC);
+    if (!renderer) renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+    if (!renderer) return false;
+    sprite_texture = SDL_CreateTextureFromSurface(renderer,
+        SDL_LoadBMP("sheet.bmp"));
+    return sprite_texture != NULL;
+}
+
+// Draws a sprite using its ID.
+// The coordinates correspond to tiles, not pixels.
+void draw_sprite(int entity_id, int tile_x, int tile_y) {
+    SDL_Rect sprite_rect = {
+        entity_id * SPRITE_SIZE, 0,
+        SPRITE_SIZE, SPRITE_SIZE
+    };
+    SDL_Rect screen_rect = {
+        tile_x * SPRITE_SIZE, tile_y * SPRITE_SIZE,
+        SPRITE_SIZE, SPRITE_SIZE
+    };
+    SDL_RenderCopy(renderer, sprite_texture, &sprite_rect, &screen_rect);
+    ++draw_calls;
+}
+
+// Draws a number on screen using a bitmap font.
+void draw_number(int number, int screen_x, int screen_y) {
+    char number_string[64];
+    snprintf(number_string, 64, "%d", number);
+    for (int i = 0; i < 64 && number_string[i]; ++i) {
+        int offset = SPRITE_SIZE * 10;
+        int char_offset = (number_string[i] - '0') * 8;
+        SDL_Rect sprite_rect = { offset + char_offset, 0, 8, 8 };
+        SDL_Rect screen_rect = { screen_x + i * 8, screen_y, 8, 8 };
+        SDL_RenderCopy(renderer, sprite_texture, &sprite_rect, &screen_rect);
+        ++draw_calls;
+    }
+}
+
+// Draws an entire level.
+void draw_level(Level level) {
+    for (int y = 0; y < LEVEL_SIZE; ++y) {
+        for (int x = 0; x < LEVEL_SIZE; ++x) {
+            Tile tile = level[x + y * LEVEL_SIZE];
+            // Check each bit of the tile, and draw the entity if
+            // the corresponding bit is set.
+            for (int bit = 1; bit <= ENTITY_TYPE_COUNT; ++bit) {
+                if (tile & BIT(bit)) draw_sprite(bit, x, y);
+            }
+        }
+    }
+}
@@ -9,6 +9,10 @@
 
 #include "common.c"
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 typedef struct {
     int x, y, w, h;
 } Rect;
@@ -78,8 +82,8 @@ void digger_generator(Level level, float * parameters) {
         // accessible from any starting point.
         int digger_x, digger_y;
         do {
-            digger_x = random_int_range(1, LEVEL_SIZE-1);
-            digger_y = random_int_range(1, LEVEL_SIZE-1);
+            digger_x = random_int_range(1, LEVEL_SIZE-2);
+            digger_y = random_int_range(1, LEVEL_SIZE-2);
         } while (i > 0 && (level[digger_x + digger_y * LEVEL_SIZE] != BIT(FLOOR)));
         int direction = random_int_range(1, 4);
 
@@ -171,6 +175,227 @@ void reverse_verified_scatter_generator(Level level) {
     }
 }
 
+// Candidate walls checked at once by verify_wall_candidates.
+#define WALL_BATCH 8
+
+// Rows of a level as bits, with bit x of row y set for each tile at x, y
+// that has (tile & mask) == target.
+void level_rows(Level level, Tile mask, Tile target, u32 * rows) {
+    for (int y = 0; y < LEVEL_SIZE; ++y) {
+        rows[y] = 0;
+        for (int x = 0; x < LEVEL_SIZE; ++x) {
+            if ((level[x + y * LEVEL_SIZE] & mask) == target) rows[y] |= BIT(x);
+        }
+    }
+}
+
+// Floods a level from the player for one candidate wall, as rows of bits:
+// each tile reached spreads to the walkable tiles next to it, going down the
+// rows and back up until nothing changes. 'blocked' is the walkable tiles
+// with the candidate taken out. Returns true if a key and the exit are reached.
+bool flood_rows_scalar(u32 * blocked, u32 * keys, u32 * exits, int px, int py) {
+    u32 reach[LEVEL_SIZE + 2] = {0};
+    u32 * r = reach + 1;
+    r[py] = BIT(px) & blocked[py];
+    u32 changed;
+    do {
+        changed = 0;
+        for (int pass = 0; pass < 2; ++pass) {
+            for (int i = 0; i < LEVEL_SIZE; ++i) {
+                int y = pass ? LEVEL_SIZE - 1 - i : i;
+                u32 grown = (r[y] | r[y] << 1 | r[y] >> 1 | r[y - 1] | r[y + 1]) & blocked[y];
+                changed |= grown ^ r[y];
+                r[y] = grown;
+            }
+        }
+    } while (changed);
+    u32 key_seen = 0, exit_seen = 0;
+    for (int y = 0; y < LEVEL_SIZE; ++y) {
+        key_seen |= r[y] & keys[y];
+        exit_seen |= r[y] & exits[y];
+    }
+    return key_seen && exit_seen;
+}
+
+#if defined(__x86_64__)
+// Same as flood_rows_scalar for 4 candidates at once, one in each 32 bit lane.
+// Returns a bit for each candidate, set if a key and the exit are reached.
+int flood_rows_sse2(u32 (*blocked)[4], u32 * keys, u32 * exits, int px, int py) {
+    __m128i walk[LEVEL_SIZE];
+    __m128i reach[LEVEL_SIZE + 2];
+    __m128i * r = reach + 1;
+    for (int y = -1; y <= LEVEL_SIZE; ++y) r[y] = _mm_setzero_si128();
+    for (int y = 0; y < LEVEL_SIZE; ++y) walk[y] = _mm_loadu_si128((__m128i *)blocked[y]);
+    r[py] = _mm_and_si128(_mm_set1_epi32(BIT(px)), walk[py]);
+    __m128i changed;
+    do {
+        changed = _mm_setzero_si128();
+        for (int pass = 0; pass < 2; ++pass) {
+            for (int i = 0; i < LEVEL_SIZE; ++i) {
+                int y = pass ? LEVEL_SIZE - 1 - i : i;
+                __m128i grown = _mm_or_si128(_mm_or_si128(r[y], _mm_slli_epi32(r[y], 1)), _mm_srli_epi32(r[y], 1));
+                grown = _mm_and_si128(_mm_or_si128(grown, _mm_or_si128(r[y - 1], r[y + 1])), walk[y]);
+                changed = _mm_or_si128(changed, _mm_xor_si128(grown, r[y]));
+                r[y] = grown;
+            }
+        }
+    } while (_mm_movemask_epi8(_mm_cmpeq_epi32(changed, _mm_setzero_si128())) != 0xffff);
+    __m128i key_seen = _mm_setzero_si128(), exit_seen = key_seen;
+    for (int y = 0; y < LEVEL_SIZE; ++y) {
+        key_seen  = _mm_or_si128(key_seen,  _mm_and_si128(r[y], _mm_set1_epi32(keys[y])));
+        exit_seen = _mm_or_si128(exit_seen, _mm_and_si128(r[y], _mm_set1_epi32(exits[y])));
+    }
+    __m128i zero = _mm_setzero_si128();
+    __m128i missing = _mm_or_si128(_mm_cmpeq_epi32(key_seen, zero), _mm_cmpeq_epi32(exit_seen, zero));
+    return ~_mm_movemask_ps(_mm_castsi128_ps(missing)) & 0xf;
+}
+
+// Same as flood_rows_sse2 for 8 candidates at once.
+__attribute__((target("avx2")))
+int flood_rows_avx2(u32 (*blocked)[8], u32 * keys, u32 * exits, int px, int py) {
+    __m256i walk[LEVEL_SIZE];
+    __m256i reach[LEVEL_SIZE + 2];
+    __m256i * r = reach + 1;
+    for (int y = -1; y <= LEVEL_SIZE; ++y) r[y] = _mm256_setzero_si256();
+    for (int y = 0; y < LEVEL_SIZE; ++y) walk[y] = _mm256_loadu_si256((__m256i *)blocked[y]);
+    r[py] = _mm256_and_si256(_mm256_set1_epi32(BIT(px)), walk[py]);
+    __m256i changed;
+    do {
+        changed = _mm256_setzero_si256();
+        for (int pass = 0; pass < 2; ++pass) {
+            for (int i = 0; i < LEVEL_SIZE; ++i) {
+                int y = pass ? LEVEL_SIZE - 1 - i : i;
+                __m256i grown = _mm256_or_si256(_mm256_or_si256(r[y], _mm256_slli_epi32(r[y], 1)), _mm256_srli_epi32(r[y], 1));
+                grown = _mm256_and_si256(_mm256_or_si256(grown, _mm256_or_si256(r[y - 1], r[y + 1])), walk[y]);
+                changed = _mm256_or_si256(changed, _mm256_xor_si256(grown, r[y]));
+                r[y] = grown;
+            }
+        }
+    } while (!_mm256_testz_si256(changed, changed));
+    __m256i key_seen = _mm256_setzero_si256(), exit_seen = key_seen;
+    for (int y = 0; y < LEVEL_SIZE; ++y) {
+        key_seen  = _mm256_or_si256(key_seen,  _mm256_and_si256(r[y], _mm256_set1_epi32(keys[y])));
+        exit_seen = _mm256_or_si256(exit_seen, _mm256_and_si256(r[y], _mm256_set1_epi32(exits[y])));
+    }
+    __m256i zero = _mm256_setzero_si256();
+    __m256i missing = _mm256_or_si256(_mm256_cmpeq_epi32(key_seen, zero), _mm256_cmpeq_epi32(exit_seen, zero));
+    return ~_mm256_movemask_ps(_mm256_castsi256_ps(missing)) & 0xff;
+}
+#endif
+
+// Checks up to WALL_BATCH candidate walls at once, each on its own: the
+// same as adding each one to the level and calling level_is_completable,
+// but with the floods of all of them done together, one in each SIMD lane.
+// Returns a bit for each candidate, set if the level stays completable.
+int verify_wall_candidates(Level level, int * candidates, int count) {
+    int px, py;
+    if (!find_player(level, &px, &py)) return 0;
+    count = MIN(count, WALL_BATCH);
+    u32 walkable[LEVEL_SIZE], keys[LEVEL_SIZE], exits[LEVEL_SIZE];
+    level_rows(level, BIT(FLOOR) | BIT(WALL) | BIT(SPIKES), BIT(FLOOR), walkable);
+    level_rows(level, BIT(KEY), BIT(KEY), keys);
+    level_rows(level, BIT(EXIT), BIT(EXIT), exits);
+
+    // The walkable tiles for each candidate, row by row, with the candidate
+    // taken out. Unused lanes have no candidate taken out.
+    u32 blocked[LEVEL_SIZE][WALL_BATCH];
+    for (int y = 0; y < LEVEL_SIZE; ++y) {
+        for (int i = 0; i < WALL_BATCH; ++i) blocked[y][i] = walkable[y];
+    }
+    for (int i = 0; i < count; ++i) {
+        int x = candidates[i] % LEVEL_SIZE, y = candidates[i] / LEVEL_SIZE;
+        blocked[y][i] &= ~BIT(x);
+    }
+
+    int passed = 0;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) {
+        passed = flood_rows_avx2(blocked, keys, exits, px, py);
+    } else {
+        u32 half[LEVEL_SIZE][4];
+        for (int h = 0; h < WALL_BATCH; h += 4) {
+            for (int y = 0; y < LEVEL_SIZE; ++y) memcpy(half[y], &blocked[y][h], sizeof(half[y]));
+            passed |= flood_rows_sse2(half, keys, exits, px, py) << h;
+        }
+    }
+#else
+    for (int i = 0; i < count; ++i) {
+        u32 rows[LEVEL_SIZE];
+        for (int y = 0; y < LEVEL_SIZE; ++y) rows[y] = blocked[y][i];
+        if (flood_rows_scalar(rows, keys, exits, px, py)) passed |= BIT(i);
+    }
+#endif
+    return passed & (BIT(count) - 1);
+}
+
+// Checks whether blocking a tile inside the border could cut off any of the
+// walkable tiles around it from each other (see is_local_cut).
+bool tile_is_local_cut(Level level, int tile) {
+    int ring_offsets[8] = {
+        -LEVEL_SIZE, -LEVEL_SIZE + 1, 1, LEVEL_SIZE + 1,
+        LEVEL_SIZE, LEVEL_SIZE - 1, -1, -LEVEL_SIZE - 1,
+    };
+    u8 ring = 0;
+    for (int n = 0; n < 8; ++n) {
+        Tile t = level[tile + ring_offsets[n]];
+        if ((t & (BIT(FLOOR) | BIT(WALL) | BIT(SPIKES))) == BIT(FLOOR)) ring |= BIT(n);
+    }
+    return is_local_cut(ring);
+}
+
+// Same as reverse_verified_scatter_generator, but tries WALL_BATCH places at
+// a time with verify_wall_candidates. Each candidate was only checked on its
+// own, and two walls that are fine on their own can cut the level together.
+// So the first that passes is taken, and the rest are only taken if they
+// cannot cut off anything, looking at the tiles around them with the walls
+// taken so far. Any others are dropped, and new places tried instead.
+void reverse_batch_verified_scatter_generator(Level level) {
+    float portion_of_level_to_be_wall = 3.0f;
+    int wall_count = portion_of_level_to_be_wall * (LEVEL_SIZE * LEVEL_SIZE);
+    int attempts = 32;
+
+    // As before, each wall gets a few attempts before it is given up on.
+    int walls_done = 0, failures = 0;
+    while (walls_done < wall_count) {
+        int candidates[WALL_BATCH];
+        int count = 0;
+        while (count < WALL_BATCH) {
+            int x = random_int_range(1, LEVEL_SIZE-2);
+            int y = random_int_range(1, LEVEL_SIZE-2);
+            // If it will overwrite the player, it counts as a failed attempt.
+            if (level[x + y * LEVEL_SIZE] & BIT(PLAYER)) candidates[count++] = -1;
+            else candidates[count++] = x + y * LEVEL_SIZE;
+        }
+        int checked[WALL_BATCH];
+        int checked_count = 0;
+        for (int i = 0; i < count; ++i) {
+            if (candidates[i] >= 0) checked[checked_count++] = candidates[i];
+        }
+        int passed = verify_wall_candidates(level, checked, checked_count);
+
+        bool taken_one = false;
+        for (int i = 0, c = 0; i < count && walls_done < wall_count; ++i) {
+            bool ok = false;
+            if (candidates[i] >= 0) {
+                int tile = candidates[i];
+                ok = passed & BIT(c++);
+                if (ok && taken_one) {
+                    // A wall here must not take the last key or the exit with it either.
+                    ok = !tile_is_local_cut(level, tile) && !(level[tile] & (BIT(KEY) | BIT(EXIT)));
+                }
+                if (ok) {
+                    level[tile] = BIT(WALL);
+                    taken_one = true;
+                }
+            }
+            if (ok || ++failures == attempts) {
+                ++walls_done;
+                failures = 0;
+            }
+        }
+    }
+}
+
 bool count_entities(Tile * tile, int x, int y, void * data) {
     int * count = data;
     if (*tile & ~(BIT(FLOOR) | BIT(WALL) | BIT(SPIKES))) {
@@ -369,6 +594,287 @@ void verified_scatter_placer(Level level, float * parameters) {
     level[x + y * LEVEL_SIZE] |= BIT(PLAYER);
 }
 
+// Finds the immediate dominator of every tile reachable from 'start', walking
+// over the tiles that match 'mask' and 'target' in the same way as flood.
+// A tile dominates another if every path from the start to it passes through it,
+// so the dominators of the exit are the chokepoints that the player must cross.
+// Unreachable tiles are given -1, and the start tile is its own dominator.
+// If 'order' is given, the reachable tiles are written into it such that every
+// tile comes after all of its dominators.
+// Returns the number of reachable tiles.
+int find_dominators(Level level, int start, Tile mask, Tile target,
+    s16 idom[LEVEL_SIZE * LEVEL_SIZE], s16 order[LEVEL_SIZE * LEVEL_SIZE]) {
+    enum { TILE_COUNT = LEVEL_SIZE * LEVEL_SIZE };
+    s16 postorder[TILE_COUNT];
+    s16 post_number[TILE_COUNT];
+    bool visited[TILE_COUNT] = {0};
+    int count = 0;
+
+    for (int i = 0; i < TILE_COUNT; ++i) idom[i] = -1;
+    if ((level[start] & mask) != (target & mask)) return 0;
+
+    // Number the tiles in depth-first postorder.
+    struct { s16 tile; s8 next; } stack[TILE_COUNT];
+    int top = 0;
+    stack[top++].tile = start;
+    stack[0].next = 0;
+    visited[start] = true;
+    while (top) {
+        int tile = stack[top - 1].tile;
+        int x = tile % LEVEL_SIZE;
+        int y = tile / LEVEL_SIZE;
+        int n = stack[top - 1].next++;
+        if (n == 4) {
+            post_number[tile] = count;
+            postorder[count++] = tile;
+            --top;
+            continue;
+        }
+        int neighbours[4][2] = { {x, y-1}, {x, y+1}, {x-1, y}, {x+1, y} };
+        int nx = neighbours[n][0];
+        int ny = neighbours[n][1];
+        if (nx < 0 || ny < 0 || nx >= LEVEL_SIZE || ny >= LEVEL_SIZE) continue;
+        int next = nx + ny * LEVEL_SIZE;
+        if (visited[next] || (level[next] & mask) != (target & mask)) continue;
+        visited[next] = true;
+        stack[top].tile = next;
+        stack[top].next = 0;
+        ++top;
+    }
+
+    // Iterate until stable, visiting tiles in reverse postorder.
+    // (Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm")
+    idom[start] = start;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = count - 2; i >= 0; --i) {
+            int tile = postorder[i];
+            int x = tile % LEVEL_SIZE;
+            int y = tile / LEVEL_SIZE;
+            int new_idom = -1;
+            int neighbours[4][2] = { {x, y-1}, {x, y+1}, {x-1, y}, {x+1, y} };
+            for (int n = 0; n < 4; ++n) {
+                int nx = neighbours[n][0];
+                int ny = neighbours[n][1];
+                if (nx < 0 || ny < 0 || nx >= LEVEL_SIZE || ny >= LEVEL_SIZE) continue;
+                int other = nx + ny * LEVEL_SIZE;
+                if (!visited[other] || idom[other] < 0) continue;
+                if (new_idom < 0) {
+                    new_idom = other;
+                } else {
+                    // Walk both up the dominator tree until they meet.
+                    int a = other, b = new_idom;
+                    while (a != b) {
+                        while (post_number[a] < post_number[b]) a = idom[a];
+                        while (post_number[b] < post_number[a]) b = idom[b];
+                    }
+                    new_idom = a;
+                }
+            }
+            if (idom[tile] != new_idom) {
+                idom[tile] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    if (order) {
+        for (int i = 0; i < count; ++i) order[i] = postorder[count - 1 - i];
+    }
+
+    return count;
+}
+
+// Finds the tiles that every path between two tiles must cross.
+// They are written into 'chokepoints' starting with the one nearest 'from'.
+// Returns how many there are, or -1 if there is no path at all.
+int find_chokepoints(Level level, int from_x, int from_y, int to_x, int to_y, s16 * chokepoints) {
+    s16 idom[LEVEL_SIZE * LEVEL_SIZE];
+    int from = from_x + from_y * LEVEL_SIZE;
+    int to = to_x + to_y * LEVEL_SIZE;
+    find_dominators(level, from,
+        BIT(FLOOR) | BIT(WALL) | BIT(SPIKES), BIT(FLOOR), idom, NULL);
+    if (idom[to] < 0) return -1;
+
+    int count = 0;
+    for (int tile = idom[to]; tile != from; tile = idom[tile]) {
+        chokepoints[count++] = tile;
+    }
+    for (int i = 0; i < count / 2; ++i) {
+        s16 swap = chokepoints[i];
+        chokepoints[i] = chokepoints[count - 1 - i];
+        chokepoints[count - 1 - i] = swap;
+    }
+    return count;
+}
+
+// Chooses evenly between the empty floor tiles of a level.
+// Returns -1 if there are none.
+int random_empty_floor(Level level) {
+    int tile = -1, seen = 0;
+    for (int i = 0; i < LEVEL_SIZE * LEVEL_SIZE; ++i) {
+        if (level[i] == BIT(FLOOR) && chance(1.0f / ++seen)) tile = i;
+    }
+    return tile;
+}
+
+// Places entities using the chokepoints of the level, in a single pass.
+// The locked exit is put behind as many chokepoints as possible, and each key
+// is put at the far end of a side branch that leaves the path to the exit
+// at a different chokepoint, so finding the keys means leaving the main route.
+// Every critical entity is chosen from tiles the player can reach, so no
+// retries are needed.
+void chokepoint_placer(Level level, float * parameters, int key_count) {
+    enum { TILE_COUNT = LEVEL_SIZE * LEVEL_SIZE };
+    float gold_chance = 0.07f;
+    float enemy_chance = 0.03f;
+    float spikes_chance = 0.03f;
+
+    if (parameters) {
+        gold_chance   = parameters[0];
+        enemy_chance  = parameters[1];
+        spikes_chance = parameters[2];
+    }
+
+    // Scatter some entities around.
+    for (int y = 1; y < LEVEL_SIZE-1; ++y) {
+        for (int x = 1; x < LEVEL_SIZE-1; ++x) {
+            Tile t = level[x + y * LEVEL_SIZE];
+            if ((t & BIT(WALL)) == 0) {
+                if (chance(gold_chance))   t |= BIT(GOLD);   else
+                if (chance(enemy_chance))  t |= BIT(ENEMY);  else
+                if (chance(spikes_chance)) t |= BIT(SPIKES);
+            }
+            level[x + y * LEVEL_SIZE] = t;
+        }
+    }
+
+    // Label each connected area of walkable tiles, so the player
+    // can be started in the largest one.
+    s16 area[TILE_COUNT];
+    s16 queue[TILE_COUNT];
+    int largest_area = -1, largest_size = 0, area_count = 0;
+    for (int i = 0; i < TILE_COUNT; ++i) area[i] = -1;
+    for (int i = 0; i < TILE_COUNT; ++i) {
+        if (area[i] >= 0 || (level[i] & (BIT(FLOOR) | BIT(WALL) | BIT(SPIKES))) != BIT(FLOOR)) continue;
+        int head = 0, tail = 0;
+        area[i] = area_count;
+        queue[tail++] = i;
+        while (head < tail) {
+            int tile = queue[head++];
+            int tx = tile % LEVEL_SIZE;
+            int ty = tile / LEVEL_SIZE;
+            int neighbours[4][2] = { {tx, ty-1}, {tx, ty+1}, {tx-1, ty}, {tx+1, ty} };
+            for (int n = 0; n < 4; ++n) {
+                int nx = neighbours[n][0];
+                int ny = neighbours[n][1];
+                if (nx < 0 || ny < 0 || nx >= LEVEL_SIZE || ny >= LEVEL_SIZE) continue;
+                int next = nx + ny * LEVEL_SIZE;
+                if (area[next] >= 0) continue;
+                if ((level[next] & (BIT(FLOOR) | BIT(WALL) | BIT(SPIKES))) != BIT(FLOOR)) continue;
+                area[next] = area_count;
+                queue[tail++] = next;
+            }
+        }
+        if (tail > largest_size) {
+            largest_size = tail;
+            largest_area = area_count;
+        }
+        ++area_count;
+    }
+
+    // Place the player on an empty floor tile, choosing evenly within the
+    // largest area, or anywhere if it has none.
+    int player = -1, seen = 0;
+    for (int i = 0; i < TILE_COUNT; ++i) {
+        if (area[i] == largest_area && level[i] == BIT(FLOOR) && chance(1.0f / ++seen)) player = i;
+    }
+    if (player < 0) player = random_empty_floor(level);
+    if (player < 0) return;
+    level[player] |= BIT(PLAYER);
+
+    s16 idom[TILE_COUNT];
+    s16 order[TILE_COUNT];
+    int reachable = find_dominators(level, player,
+        BIT(FLOOR) | BIT(WALL) | BIT(SPIKES), BIT(FLOOR), idom, order);
+
+    // Depth in the dominator tree is the number of chokepoints above a tile.
+    // Dominators always come first in 'order', so one pass is enough.
+    int depth[TILE_COUNT] = {0};
+    for (int i = 1; i < reachable; ++i) depth[order[i]] = depth[idom[order[i]]] + 1;
+
+    // The exit goes on the deepest empty tile, choosing evenly between ties.
+    int exit = -1, ties = 0;
+    for (int i = 1; i < reachable; ++i) {
+        int tile = order[i];
+        if (level[tile] != BIT(FLOOR)) continue;
+        if (exit < 0 || depth[tile] > depth[exit]) {
+            exit = tile;
+            ties = 1;
+        } else if (depth[tile] == depth[exit] && chance(1.0f / ++ties)) {
+            exit = tile;
+        }
+    }
+
+    // The player is boxed in, so nothing else can be made reachable.
+    if (exit < 0) exit = random_empty_floor(level);
+    if (exit < 0) return;
+    level[exit] |= BIT(EXIT) | BIT(LOCK);
+    if (idom[exit] < 0) return;
+
+    // Mark the route to the exit, and number the chokepoints along it.
+    // The player counts as the first branching point.
+    bool on_route[TILE_COUNT] = {0};
+    int route_index[TILE_COUNT];
+    int route_length = 0;
+    for (int tile = idom[exit]; ; tile = idom[tile]) {
+        on_route[tile] = true;
+        ++route_length;
+        if (tile == player) break;
+    }
+    for (int tile = idom[exit], i = route_length - 1; ; tile = idom[tile], --i) {
+        route_index[tile] = i;
+        if (tile == player) break;
+    }
+
+    // For every tile off the route, find where its branch leaves the route,
+    // and keep the deepest empty tile of each branching point.
+    s16 branch[TILE_COUNT];
+    int deepest[TILE_COUNT];
+    for (int i = 0; i < route_length; ++i) deepest[i] = -1;
+    for (int i = 1; i < reachable; ++i) {
+        int tile = order[i];
+        if (on_route[tile] || tile == exit) continue;
+        branch[tile] = on_route[idom[tile]] ? idom[tile] : branch[idom[tile]];
+        if (level[tile] != BIT(FLOOR)) continue;
+        int b = route_index[branch[tile]];
+        if (deepest[b] < 0 || depth[tile] > depth[deepest[b]]) deepest[b] = tile;
+    }
+
+    // Spread the keys evenly over the branching points that have room for one.
+    int candidates[TILE_COUNT];
+    int candidate_count = 0;
+    for (int i = 0; i < route_length; ++i) {
+        if (deepest[i] >= 0) candidates[candidate_count++] = deepest[i];
+    }
+
+    int placed = 0;
+    for (int k = 0; k < key_count && k < candidate_count; ++k) {
+        int tile = candidates[k * candidate_count / MIN(key_count, candidate_count)];
+        level[tile] |= BIT(KEY);
+        ++placed;
+    }
+
+    // If there were not enough branches, use any other empty tiles the player can reach.
+    for (int i = reachable - 1; i > 0 && placed < key_count; --i) {
+        if (level[order[i]] == BIT(FLOOR)) {
+            level[order[i]] |= BIT(KEY);
+            ++placed;
+        }
+    }
+}
+
 #ifndef NO_MAIN
 
 int main(int argument_count, char ** arguments) {
@@ -379,7 +885,7 @@ int main(int argument_count, char ** arguments) {
     empty_level(level);
     scatter_placer(level, NULL);
 
-    reverse_verified_scatter_generator(level);
+    reverse_batch_verified_scatter_generator(level);
 
     // This shows a very basic ASCII representation of the level.
     print_ascii_level(level);
@@ -0,0 +1,176 @@
+/*
+    mapfile.c
+    Maps kept in a memory-mapped file, for worlds bigger than memory.
+
+    A 65536 by 65536 map is 8 GB of tiles. Mapping the file lets the operating
+    system page tiles in and out as they are used, so any code that goes
+    through map_tile works on it unchanged. The tiles are stored in 64 by 64
+    blocks (8 KB each), so that a flood or a generator working on one area of
+    the map touches a few pages rather than one page per row.
+
+    Code that sweeps over the map can tell the system which area it will work
+    on next with prefetch_map_area, and which it is finished with using
+    release_map_area, so that pages are read ahead and dropped behind it.
+    for_each_map_band does this for code that works down the map a band of
+    rows at a time, and map_file_flood does it for map_flood.
+
+    POSIX only.
+*/
+
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "common.c"
+
+#define MAP_FILE_MAGIC 0x4250414d
+#define MAP_FILE_BLOCK_SHIFT 6
+// The tiles start a page into the file, after the header.
+#define MAP_FILE_HEADER_SIZE 4096
+
+typedef struct {
+    Map map;
+    int file;
+    u8 * base;
+    size_t size;
+} Map_File;
+
+// Opens a map file, creating it with every tile cleared if it does not exist.
+// The width and height are only used when creating; an existing file keeps its own.
+// New files are sparse, so blocks take no disk space until they are written.
+bool open_map_file(Map_File * map_file, const char * path, int width, int height) {
+    *map_file = (Map_File){ .file = -1 };
+    map_file->file = open(path, O_RDWR | O_CREAT, 0644);
+    if (map_file->file < 0) return false;
+
+    u32 header[4];
+    bool exists = pread(map_file->file, header, sizeof(header), 0) == sizeof(header);
+    if (exists) {
+        if (header[0] != MAP_FILE_MAGIC) goto fail;
+        width = header[1];
+        height = header[2];
+    }
+
+    Map * map = &map_file->map;
+    map->width = width;
+    map->height = height;
+    map->block_shift = MAP_FILE_BLOCK_SHIFT;
+    map->blocks_x = (width + (1 << MAP_FILE_BLOCK_SHIFT) - 1) >> MAP_FILE_BLOCK_SHIFT;
+    map_file->size = MAP_FILE_HEADER_SIZE + map_tile_count(map) * sizeof(Tile);
+
+    if (!exists) {
+        u32 new_header[4] = { MAP_FILE_MAGIC, width, height, MAP_FILE_BLOCK_SHIFT };
+        if (ftruncate(map_file->file, map_file->size) != 0) goto fail;
+        if (pwrite(map_file->file, new_header, sizeof(new_header), 0) != sizeof(new_header)) goto fail;
+    }
+
+    map_file->base = mmap(NULL, map_file->size, PROT_READ | PROT_WRITE, MAP_SHARED, map_file->file, 0);
+    if (map_file->base == MAP_FAILED) goto fail;
+    map->tiles = (Tile *)(map_file->base + MAP_FILE_HEADER_SIZE);
+    return true;
+
+fail:
+    close(map_file->file);
+    *map_file = (Map_File){ .file = -1 };
+    return false;
+}
+
+void close_map_file(Map_File * map_file) {
+    forget_wall_distance(&map_file->map);
+    if (map_file->base) munmap(map_file->base, map_file->size);
+    if (map_file->file >= 0) close(map_file->file);
+    *map_file = (Map_File){ .file = -1 };
+}
+
+// Calls madvise on every block that overlaps the area, one row of blocks at a time.
+void advise_map_area(Map_File * map_file, int x0, int y0, int x1, int y1, int advice) {
+    Map * map = &map_file->map;
+    int shift = map->block_shift;
+    x0 = CLAMP(0, x0, map->width - 1);
+    x1 = CLAMP(0, x1, map->width - 1);
+    y0 = CLAMP(0, y0, map->height - 1);
+    y1 = CLAMP(0, y1, map->height - 1);
+    if (x0 > x1 || y0 > y1) return;
+
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t block_bytes = sizeof(Tile) << (shift * 2);
+    for (int by = y0 >> shift; by <= y1 >> shift; ++by) {
+        // The blocks of one row of blocks are next to each other in the file.
+        u8 * start = (u8 *)map_tile(map, x0 & ~((1 << shift) - 1), by << shift);
+        u8 * end = (u8 *)map_tile(map, x1 & ~((1 << shift) - 1), by << shift) + block_bytes;
+        u8 * page = (u8 *)((uintptr_t)start & ~(page_size - 1));
+        madvise(page, end - page, advice);
+    }
+}
+
+// Asks for the blocks covering an area to be read in ahead of use.
+void prefetch_map_area(Map_File * map_file, int x0, int y0, int x1, int y1) {
+    advise_map_area(map_file, x0, y0, x1, y1, MADV_WILLNEED);
+}
+
+// Lets the blocks covering an area be dropped from memory. Changes are kept,
+// as the mapping is shared with the file.
+void release_map_area(Map_File * map_file, int x0, int y0, int x1, int y1) {
+    advise_map_area(map_file, x0, y0, x1, y1, MADV_DONTNEED);
+}
+
+typedef struct {
+    Map_File * map_file;
+    Flood_Func func;
+    void * data;
+    // The block the flood was last in, and a bit for each block that has
+    // had the blocks around it read in.
+    int block;
+    u8 * prefetched;
+} Map_File_Flood;
+
+bool prefetch_flood_tile(Tile * tile, int x, int y, void * data) {
+    Map_File_Flood * flood = data;
+    Map * map = &flood->map_file->map;
+    int shift = map->block_shift;
+    int block = (x >> shift) + (y >> shift) * map->blocks_x;
+    if (block != flood->block) {
+        flood->block = block;
+        // A flood moves on to the tiles next to the ones it has filled, so
+        // read in the blocks around this one before it gets to them.
+        if (!(flood->prefetched[block >> 3] & BIT(block & 7))) {
+            flood->prefetched[block >> 3] |= BIT(block & 7);
+            int size = 1 << shift;
+            int x0 = (x >> shift) * size, y0 = (y >> shift) * size;
+            prefetch_map_area(flood->map_file, x0 - size, y0 - size, x0 + 2 * size - 1, y0 + 2 * size - 1);
+        }
+    }
+    return flood->func(tile, x, y, flood->data);
+}
+
+// Does the same as map_flood, reading in the blocks around wherever the
+// flood is before it reaches them, so it waits on the disk less.
+s64 map_file_flood(Map_File * map_file, int start_x, int start_y, Tile mask, Tile target, Flood_Func func, void * data) {
+    Map * map = &map_file->map;
+    int shift = map->block_shift;
+    size_t block_count = (size_t)map->blocks_x * ((map->height + (1 << shift) - 1) >> shift);
+    Map_File_Flood flood = { map_file, func, data, -1, calloc((block_count + 7) / 8, 1) };
+    if (!flood.prefetched) return map_flood(map, start_x, start_y, mask, target, func, data);
+    s64 steps_taken = map_flood(map, start_x, start_y, mask, target, prefetch_flood_tile, &flood);
+    free(flood.prefetched);
+    return steps_taken;
+}
+
+// Calls 'func' for each band of rows in turn, from the top of the map down.
+// The next band is prefetched while 'func' works, and each band is released
+// once done, so only about two bands are ever held in memory.
+typedef void (*Map_Band_Func)(Map * map, int y0, int y1, void * data);
+void for_each_map_band(Map_File * map_file, int band_height, Map_Band_Func func, void * data) {
+    Map * map = &map_file->map;
+    // Bands are whole rows of blocks, so no block is released while still in use.
+    int block_size = 1 << map->block_shift;
+    band_height = (MAX(block_size, band_height) + block_size - 1) & ~(block_size - 1);
+    prefetch_map_area(map_file, 0, 0, map->width - 1, band_height - 1);
+    for (int y = 0; y < map->height; y += band_height) {
+        int y1 = MIN(y + band_height, map->height) - 1;
+        prefetch_map_area(map_file, 0, y1 + 1, map->width - 1, y1 + band_height);
+        func(map, y, y1, data);
+        release_map_area(map_file, 0, y, map->width - 1, y1);
+    }
+}
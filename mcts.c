@@ -0,0 +1,363 @@
+/*
+    mcts.c
+    Designs a level one placement at a time, using Monte Carlo tree search.
+
+    The design starts as an open room with the player, key and exit in it.
+    Each decision puts one thing on an empty floor tile: a wall, spikes, gold
+    or an enemy. To choose a placement, the search tries many sequences of
+    the placements left to make. Each goes down the tree of placements tried
+    so far, picking the most promising one at each step (UCT), tries one new
+    placement at the end, and then finishes the level with random placements
+    (a rollout). The finished level is scored, and the score is added to
+    every placement on the way down. After a fixed number of tries, the
+    placement tried most is made.
+
+    A finished level scores 0 if it cannot be completed, checked with the
+    row bitboard flood from level.c. Otherwise the score goes up with the
+    length of the walk from the player to the key and the exit, and with how
+    near the gold and enemies are to the numbers wanted (see metrics.c).
+    Walls and spikes in a rollout are only put where they cannot cut off
+    anything around them, so most rollouts stay completable, and the score
+    is about how the level plays rather than whether it can be finished.
+
+    With hundreds of empty tiles and four things to put on each, there are
+    too many placements to try them all. A placement only gets a new one to
+    try next to it once it has been tried enough: a placement tried n times
+    can have 1 + WIDEN_SCALE * n^WIDEN_POWER placements after it.
+
+    All threads work on one tree, locking it to go down and to add the
+    score, but not for the rollout, which takes most of the time. Each
+    thread going down adds a virtual loss to the placements it passes, as if
+    it had already scored 0 there, so other threads spread out to other
+    placements rather than all following the same path. Once the rollout is
+    scored, the virtual loss is taken back off.
+
+    After each decision, the part of the tree under the placement that was
+    made is kept for the next decision, and the rest is thrown away. The
+    tries already made under it count towards the next decision, so the
+    tree does not start from nothing each time, and each decision takes the
+    same fixed number of tries.
+
+    Build with `cc -O2 mcts.c -o mcts -pthread -lm`.
+    Run with `./mcts [threads] [tries] [seed] > designed.lvl`, with 'tries'
+    for each decision.
+*/
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#define NO_MAIN
+#include "level.c"
+#include "metrics.c"
+
+#define DESIGN_PLACEMENTS 80
+#define EXPLORATION 0.7f
+#define WIDEN_SCALE 1.0f
+#define WIDEN_POWER 0.5f
+// Random tiles looked at when looking for a new placement to try.
+#define PLACEMENT_TRIES 32
+
+typedef struct Mcts_Node Mcts_Node;
+struct Mcts_Node {
+    // The placement that leads here from the parent.
+    u16 tile;
+    u8 entity;
+    // No placement was found that had not been tried already.
+    bool exhausted;
+    Mcts_Node * parent;
+    Mcts_Node * first_child;
+    Mcts_Node * next_sibling;
+    int child_count;
+    int visits, virtual_loss;
+    double total_score;
+};
+
+typedef struct {
+    int target_path, target_gold, target_enemies;
+    int tries_per_decision;
+    int thread_count;
+    u64 seed;
+
+    // The level with the placements made so far, and how many are left.
+    Level level;
+    int placements_left;
+    Mcts_Node * root;
+    pthread_mutex_t lock;
+    atomic_int tries_left;
+    int decision;
+    s64 nodes_made, tries_kept;
+} Mcts_Designer;
+
+void free_mcts_tree(Mcts_Node * node) {
+    Mcts_Node * child = node->first_child;
+    while (child) {
+        Mcts_Node * next = child->next_sibling;
+        free_mcts_tree(child);
+        child = next;
+    }
+    free(node);
+}
+
+void apply_placement(Level level, int tile, int entity) {
+    if (entity == WALL) level[tile] = BIT(WALL);
+    else level[tile] = BIT(FLOOR) | BIT(entity);
+}
+
+// Picks a random thing to put somewhere, with walls the most likely.
+int random_placement_entity(void) {
+    float r = random_float();
+    if (r < 0.6f) return WALL;
+    if (r < 0.7f) return SPIKES;
+    if (r < 0.85f) return GOLD;
+    return ENEMY;
+}
+
+// Finds a random empty floor tile. Returns -1 if none was found.
+int random_empty_tile(Level level) {
+    for (int i = 0; i < PLACEMENT_TRIES; ++i) {
+        int tile = random_int_range(1, LEVEL_SIZE-2) + random_int_range(1, LEVEL_SIZE-2) * LEVEL_SIZE;
+        if (level[tile] == BIT(FLOOR)) return tile;
+    }
+    return -1;
+}
+
+// The same check as level_is_completable, using the row bitboard flood.
+bool design_is_completable(Level level) {
+    int px, py;
+    if (!find_player(level, &px, &py)) return false;
+    u32 walkable[LEVEL_SIZE], keys[LEVEL_SIZE], exits[LEVEL_SIZE];
+    level_rows(level, BIT(FLOOR) | BIT(WALL) | BIT(SPIKES), BIT(FLOOR), walkable);
+    level_rows(level, BIT(KEY), BIT(KEY), keys);
+    level_rows(level, BIT(EXIT), BIT(EXIT), exits);
+    return flood_rows_scalar(walkable, keys, exits, px, py);
+}
+
+// How near 'value' is to 'target', from 0 to 1.
+float closeness(int value, int target) {
+    float off = fabsf((float)(value - target)) / MAX(1, target);
+    return MAX(0.0f, 1.0f - off);
+}
+
+// Scores a finished level from 0 to 1.
+float design_score(Mcts_Designer * designer, Level level) {
+    int px, py;
+    if (!find_player(level, &px, &py) || !design_is_completable(level)) return 0;
+    u16 distance[LEVEL_SIZE * LEVEL_SIZE];
+    int path = walk_length(level, px + py * LEVEL_SIZE, distance);
+    if (path == NO_PATH) return 0;
+    int gold = 0, enemies = 0;
+    for (int i = 0; i < LEVEL_SIZE * LEVEL_SIZE; ++i) {
+        gold += (level[i] >> GOLD) & 1;
+        enemies += (level[i] >> ENEMY) & 1;
+    }
+    float walk = MIN(1.0f, (float)path / designer->target_path);
+    return 0.7f * walk + 0.15f * closeness(gold, designer->target_gold)
+        + 0.15f * closeness(enemies, designer->target_enemies);
+}
+
+// Finishes the level with random placements, and scores it.
+float rollout(Mcts_Designer * designer, Level level, int placements) {
+    for (int p = 0; p < placements; ++p) {
+        int tile = random_empty_tile(level);
+        if (tile < 0) break;
+        int entity = random_placement_entity();
+        if ((entity == WALL || entity == SPIKES) && tile_is_local_cut(level, tile)) continue;
+        apply_placement(level, tile, entity);
+    }
+    return design_score(designer, level);
+}
+
+// Adds a child for a placement not yet tried from this node, on the level
+// as it is at this node. Returns NULL if none was found.
+Mcts_Node * expand(Mcts_Designer * designer, Mcts_Node * node, Level level) {
+    for (int i = 0; i < PLACEMENT_TRIES; ++i) {
+        int tile = random_empty_tile(level);
+        if (tile < 0) break;
+        int entity = random_placement_entity();
+        bool tried = false;
+        for (Mcts_Node * child = node->first_child; child && !tried; child = child->next_sibling) {
+            tried = child->tile == tile && child->entity == entity;
+        }
+        if (tried) continue;
+
+        Mcts_Node * child = calloc(1, sizeof(Mcts_Node));
+        if (!child) return NULL;
+        child->tile = tile;
+        child->entity = entity;
+        child->parent = node;
+        child->next_sibling = node->first_child;
+        node->first_child = child;
+        ++node->child_count;
+        ++designer->nodes_made;
+        return child;
+    }
+    node->exhausted = true;
+    return NULL;
+}
+
+// The child with the best upper bound on its score. Virtual losses count
+// as tries that scored 0.
+Mcts_Node * select_child(Mcts_Node * node) {
+    Mcts_Node * best = NULL;
+    float best_value = -1;
+    float log_visits = logf(MAX(1, node->visits + node->virtual_loss));
+    for (Mcts_Node * child = node->first_child; child; child = child->next_sibling) {
+        int n = child->visits + child->virtual_loss;
+        if (n == 0) return child;
+        float value = child->total_score / n + EXPLORATION * sqrtf(log_visits / n);
+        if (value > best_value) {
+            best_value = value;
+            best = child;
+        }
+    }
+    return best;
+}
+
+void search_once(Mcts_Designer * designer) {
+    Level level;
+    pthread_mutex_lock(&designer->lock);
+    memcpy(level, designer->level, sizeof(Level));
+    int placements = designer->placements_left;
+    Mcts_Node * node = designer->root;
+    ++node->virtual_loss;
+    while (placements > 0) {
+        int allowed = 1 + (int)(WIDEN_SCALE * powf(node->visits, WIDEN_POWER));
+        Mcts_Node * next = NULL;
+        bool expanded = false;
+        if (node->child_count < allowed && !node->exhausted) {
+            next = expand(designer, node, level);
+            expanded = next != NULL;
+        }
+        if (!next) next = select_child(node);
+        if (!next) break;
+        node = next;
+        ++node->virtual_loss;
+        apply_placement(level, node->tile, node->entity);
+        --placements;
+        if (expanded) break;
+    }
+    pthread_mutex_unlock(&designer->lock);
+
+    float score = rollout(designer, level, placements);
+
+    pthread_mutex_lock(&designer->lock);
+    for (; node; node = node->parent) {
+        --node->virtual_loss;
+        ++node->visits;
+        node->total_score += score;
+    }
+    pthread_mutex_unlock(&designer->lock);
+}
+
+void * mcts_thread(void * data) {
+    Mcts_Designer * designer = data;
+    static atomic_int thread_number;
+    int number = atomic_fetch_add(&thread_number, 1);
+    reset_seed(designer->seed, (u64)designer->decision << 32 | number);
+    while (atomic_fetch_sub(&designer->tries_left, 1) > 0) search_once(designer);
+    return NULL;
+}
+
+// Makes the placement tried most from the root, and keeps the tree under it.
+// Returns false if there was nothing to place.
+bool make_decision(Mcts_Designer * designer) {
+    Mcts_Node * best = NULL;
+    for (Mcts_Node * child = designer->root->first_child; child; child = child->next_sibling) {
+        if (!best || child->visits > best->visits) best = child;
+    }
+    if (!best) return false;
+
+    // Unhook the child kept, then throw away the rest.
+    Mcts_Node ** link = &designer->root->first_child;
+    while (*link != best) link = &(*link)->next_sibling;
+    *link = best->next_sibling;
+    best->next_sibling = NULL;
+    best->parent = NULL;
+    free_mcts_tree(designer->root);
+    designer->root = best;
+
+    apply_placement(designer->level, best->tile, best->entity);
+    --designer->placements_left;
+    return true;
+}
+
+// Designs a level from the one given, making up to DESIGN_PLACEMENTS
+// placements. Returns false if out of memory.
+bool design_level(Mcts_Designer * designer, Level level) {
+    memcpy(designer->level, level, sizeof(Level));
+    designer->placements_left = DESIGN_PLACEMENTS;
+    designer->root = calloc(1, sizeof(Mcts_Node));
+    if (!designer->root) return false;
+    pthread_mutex_init(&designer->lock, NULL);
+
+    int thread_count = MAX(1, designer->thread_count);
+    for (designer->decision = 0; designer->placements_left > 0; ++designer->decision) {
+        designer->tries_kept += designer->root->visits;
+        atomic_store(&designer->tries_left, designer->tries_per_decision);
+        pthread_t threads[thread_count];
+        int started = 0;
+        for (int i = 1; i < thread_count; ++i) {
+            if (pthread_create(&threads[started], NULL, mcts_thread, designer) == 0) ++started;
+        }
+        mcts_thread(designer);
+        for (int i = 0; i < started; ++i) pthread_join(threads[i], NULL);
+        if (!make_decision(designer)) break;
+    }
+
+    free_mcts_tree(designer->root);
+    designer->root = NULL;
+    pthread_mutex_destroy(&designer->lock);
+    memcpy(level, designer->level, sizeof(Level));
+    return true;
+}
+
+// An open room with the player, key and exit in it.
+void starting_level(Level level) {
+    empty_level(level);
+    int entities[] = { EXIT, KEY, PLAYER };
+    for (int e = 0; e < 3; ++e) {
+        int tile;
+        do tile = random_int_range(1, LEVEL_SIZE-2) + random_int_range(1, LEVEL_SIZE-2) * LEVEL_SIZE;
+        while (level[tile] != BIT(FLOOR));
+        level[tile] |= BIT(entities[e]);
+        if (entities[e] == EXIT) level[tile] |= BIT(LOCK);
+    }
+}
+
+int main(int argument_count, char ** arguments) {
+    Mcts_Designer designer = {
+        .target_path = 120,
+        .target_gold = 10,
+        .target_enemies = 4,
+        .thread_count = argument_count > 1 ? atoi(arguments[1]) : sysconf(_SC_NPROCESSORS_ONLN),
+        .tries_per_decision = argument_count > 2 ? atoi(arguments[2]) : 500,
+        .seed = argument_count > 3 ? strtoull(arguments[3], NULL, 10) : 1,
+    };
+
+    reset_seed(designer.seed, 0);
+    Level level;
+    starting_level(level);
+    float start_score = design_score(&designer, level);
+
+    double start = seconds_now();
+    if (!design_level(&designer, level)) {
+        fprintf(stderr, "Not enough memory.\n");
+        return 1;
+    }
+    double seconds = seconds_now() - start;
+
+    int px, py;
+    find_player(level, &px, &py);
+    u16 distance[LEVEL_SIZE * LEVEL_SIZE];
+    int path = walk_length(level, px + py * LEVEL_SIZE, distance);
+    write_level(stdout, level);
+    fprintf(stderr, "%d placements in %.3f s (%.1f ms each) with %d threads, %d tries each.\n",
+        designer.decision, seconds, seconds / MAX(1, designer.decision) * 1e3,
+        designer.thread_count, designer.tries_per_decision);
+    fprintf(stderr, "%lld nodes made, %lld tries kept from one decision to the next.\n",
+        (long long)designer.nodes_made, (long long)designer.tries_kept);
+    fprintf(stderr, "Score %.3f, up from %.3f. Completable: %s. Walk: %d steps.\n",
+        design_score(&designer, level), start_score,
+        design_is_completable(level) ? "yes" : "no", path == NO_PATH ? -1 : path);
+}
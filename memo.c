@@ -0,0 +1,272 @@
+/*
+    memo.c
+    Keeps the results of generator stages, so trying new parameters for a later stage does not redo the earlier ones.
+
+    A level is made by running stages one after another, such as
+    digger_generator and then verified_scatter_placer. When tuning the
+    parameters of the last stage, every trial used to run the whole pipeline
+    again, though everything before that stage comes out the same each time.
+
+    A stage's result depends only on the level it is given, its parameters,
+    and the state of the random number generator when it starts. So each
+    result is kept under those: the stage, the generator state, and hashes of
+    the parameters and the level. When a stage is run again with all of them
+    the same, the level it made is copied out instead, and the generator is
+    put back to where the stage left it, so later stages carry on exactly as
+    if it had run. A stage whose input changed misses, and so does every
+    stage after it, as its input is then different too. Only the stages from
+    the first changed parameter onwards are run.
+
+    The memo holds at most 'capacity' results. When it is full, the one used
+    least recently is dropped.
+
+    Stages must not use anything else that could change between runs, such
+    as the time or global state other than the random number generator.
+    Results are matched by 64 bit hashes, so two different levels or sets of
+    parameters could in principle be taken for each other, but it is very
+    unlikely.
+
+    How much is saved depends on what comes before the stage being tuned.
+    In the demo, the digger and rooms take a small part of the time that
+    verified_scatter_placer does, so sweeping its parameters saves little;
+    sweeping poisson_placer, which comes after it, skips the slow part.
+
+    Build with `cc -O2 memo.c -o memo -lm`.
+    Run with `./memo [seeds] [capacity] [stage]` to time a sweep of the
+    parameters of stage 2 (verified_scatter_placer) or 3 (poisson_placer)
+    of the demo pipeline, with and without the memo.
+*/
+
+#include "common.c"
+
+#define MEMO_EMPTY -1
+
+typedef void (*Stage_Function)(Level level, float * parameters);
+
+typedef struct {
+    Stage_Function function;
+    float * parameters;
+    int parameter_count;
+} Pipeline_Stage;
+
+typedef struct {
+    // What the stage was given.
+    Stage_Function function;
+    u64 seed[2];
+    u64 parameter_hash, input_hash;
+    u64 key;
+    // What it made, and where it left the random number generator.
+    Level level;
+    u64 seed_after[2];
+    // Entries in order of use, and the next entry in the same bucket.
+    int newer, older, next;
+} Memo_Entry;
+
+typedef struct {
+    Memo_Entry * entries;
+    int * buckets;
+    int capacity, count, bucket_count;
+    // Most and least recently used entries.
+    int newest, oldest;
+    u64 hits, misses;
+} Stage_Memo;
+
+u64 memo_hash(void * data, size_t size, u64 hash) {
+    u8 * bytes = data;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3;
+    }
+    return hash;
+}
+
+bool make_stage_memo(Stage_Memo * memo, int capacity) {
+    *memo = (Stage_Memo){0};
+    capacity = MAX(1, capacity);
+    // Twice as many buckets as entries keeps the chains short.
+    int bucket_count = 1;
+    while (bucket_count < 2 * capacity) bucket_count *= 2;
+    memo->entries = malloc(sizeof(Memo_Entry) * capacity);
+    memo->buckets = malloc(sizeof(int) * bucket_count);
+    if (!memo->entries || !memo->buckets) {
+        free(memo->entries);
+        free(memo->buckets);
+        *memo = (Stage_Memo){0};
+        return false;
+    }
+    for (int b = 0; b < bucket_count; ++b) memo->buckets[b] = MEMO_EMPTY;
+    memo->capacity = capacity;
+    memo->bucket_count = bucket_count;
+    memo->newest = memo->oldest = MEMO_EMPTY;
+    return true;
+}
+
+void free_stage_memo(Stage_Memo * memo) {
+    free(memo->entries);
+    free(memo->buckets);
+    *memo = (Stage_Memo){0};
+}
+
+// Takes an entry out of the order of use.
+void memo_unlink(Stage_Memo * memo, int index) {
+    Memo_Entry * entry = &memo->entries[index];
+    if (entry->newer != MEMO_EMPTY) memo->entries[entry->newer].older = entry->older;
+    else memo->newest = entry->older;
+    if (entry->older != MEMO_EMPTY) memo->entries[entry->older].newer = entry->newer;
+    else memo->oldest = entry->newer;
+}
+
+// Puts an entry at the front of the order of use.
+void memo_use(Stage_Memo * memo, int index) {
+    Memo_Entry * entry = &memo->entries[index];
+    entry->newer = MEMO_EMPTY;
+    entry->older = memo->newest;
+    if (memo->newest != MEMO_EMPTY) memo->entries[memo->newest].newer = index;
+    memo->newest = index;
+    if (memo->oldest == MEMO_EMPTY) memo->oldest = index;
+}
+
+// Gets an entry to fill, dropping the least recently used one if it is full.
+int memo_take_entry(Stage_Memo * memo) {
+    if (memo->count < memo->capacity) return memo->count++;
+    int index = memo->oldest;
+    memo_unlink(memo, index);
+    int * link = &memo->buckets[memo->entries[index].key & (memo->bucket_count - 1)];
+    while (*link != index) link = &memo->entries[*link].next;
+    *link = memo->entries[index].next;
+    return index;
+}
+
+// Runs one stage on the level, or copies out what it made last time it was
+// run with the same level, parameters and random number generator state.
+// With no memo, the stage is always run.
+void run_stage(Stage_Memo * memo, Pipeline_Stage * stage, Level level) {
+    if (!memo) {
+        stage->function(level, stage->parameters);
+        return;
+    }
+
+    u64 parameter_hash = memo_hash(&stage->parameter_count, sizeof(int), 0xcbf29ce484222325);
+    if (stage->parameters) {
+        parameter_hash = memo_hash(stage->parameters, sizeof(float) * stage->parameter_count, parameter_hash);
+    }
+    u64 input_hash = memo_hash(level, sizeof(Level), 0xcbf29ce484222325);
+    u64 key = memo_hash(&stage->function, sizeof(stage->function), input_hash ^ parameter_hash);
+    key = memo_hash(random_seed, sizeof(random_seed), key);
+
+    int * bucket = &memo->buckets[key & (memo->bucket_count - 1)];
+    for (int index = *bucket; index != MEMO_EMPTY; index = memo->entries[index].next) {
+        Memo_Entry * entry = &memo->entries[index];
+        if (entry->key != key || entry->function != stage->function) continue;
+        if (entry->seed[0] != random_seed[0] || entry->seed[1] != random_seed[1]) continue;
+        if (entry->parameter_hash != parameter_hash || entry->input_hash != input_hash) continue;
+        memcpy(level, entry->level, sizeof(Level));
+        random_seed[0] = entry->seed_after[0];
+        random_seed[1] = entry->seed_after[1];
+        memo_unlink(memo, index);
+        memo_use(memo, index);
+        ++memo->hits;
+        return;
+    }
+
+    ++memo->misses;
+    u64 seed[2] = { random_seed[0], random_seed[1] };
+    stage->function(level, stage->parameters);
+
+    int index = memo_take_entry(memo);
+    Memo_Entry * entry = &memo->entries[index];
+    entry->function = stage->function;
+    entry->seed[0] = seed[0];
+    entry->seed[1] = seed[1];
+    entry->parameter_hash = parameter_hash;
+    entry->input_hash = input_hash;
+    entry->key = key;
+    memcpy(entry->level, level, sizeof(Level));
+    entry->seed_after[0] = random_seed[0];
+    entry->seed_after[1] = random_seed[1];
+    // The bucket may have been emptied by dropping an entry, so find it again.
+    bucket = &memo->buckets[key & (memo->bucket_count - 1)];
+    entry->next = *bucket;
+    *bucket = index;
+    memo_use(memo, index);
+}
+
+// Runs each stage in turn on the level, which holds what the first stage is
+// given. Seed the random number generator (with reset_seed) before calling.
+void run_pipeline(Stage_Memo * memo, Pipeline_Stage * stages, int stage_count, Level level) {
+    for (int s = 0; s < stage_count; ++s) run_stage(memo, &stages[s], level);
+}
+
+#ifndef NO_MAIN
+
+#define NO_MAIN
+#include "level.c"
+#include "poisson.c"
+
+void room_stage(Level level, float * parameters) {
+    basic_room_generator(level);
+}
+
+// Runs the pipeline for every seed and 16 values of the first parameter of
+// stage 'swept', and returns a hash of all the levels made, to check that
+// the memo makes no difference.
+u64 sweep(Stage_Memo * memo, Pipeline_Stage * stages, int stage_count, int swept, int seed_count) {
+    u64 hash = 0xcbf29ce484222325;
+    float * parameters = stages[swept].parameters;
+    float first = parameters[0];
+    for (int v = 0; v < 16; ++v) {
+        parameters[0] = first * (0.5f + v / 16.0f);
+        for (int s = 0; s < seed_count; ++s) {
+            Level level;
+            fill_level(level, WALL);
+            reset_seed(s, 1);
+            run_pipeline(memo, stages, stage_count, level);
+            hash = memo_hash(level, sizeof(Level), hash);
+        }
+    }
+    parameters[0] = first;
+    return hash;
+}
+
+int main(int argument_count, char ** arguments) {
+    int seed_count = argument_count > 1 ? atoi(arguments[1]) : 64;
+    int capacity = argument_count > 2 ? atoi(arguments[2]) : 1024;
+    int swept = argument_count > 3 ? atoi(arguments[3]) : 2;
+
+    float scatter[3] = { 0.07f, 0.03f, 0.03f };
+    float spacing[3] = { 0.5f, 0.5f, 0.5f };
+    Pipeline_Stage stages[] = {
+        { digger_generator },
+        { room_stage },
+        { verified_scatter_placer, scatter, 3 },
+        { poisson_placer, spacing, 3 },
+    };
+    char * stage_names[] = { "digger_generator", "basic_room_generator", "verified_scatter_placer", "poisson_placer" };
+    int stage_count = sizeof(stages) / sizeof(stages[0]);
+    if (swept < 2 || swept >= stage_count) {
+        fprintf(stderr, "Only stages 2 (%s) and 3 (%s) have parameters.\n", stage_names[2], stage_names[3]);
+        return 1;
+    }
+
+    double start = seconds_now();
+    u64 plain = sweep(NULL, stages, stage_count, swept, seed_count);
+    double plain_seconds = seconds_now() - start;
+
+    Stage_Memo memo;
+    if (!make_stage_memo(&memo, capacity)) {
+        fprintf(stderr, "Not enough memory for %d results.\n", capacity);
+        return 1;
+    }
+    start = seconds_now();
+    u64 memoised = sweep(&memo, stages, stage_count, swept, seed_count);
+    double memo_seconds = seconds_now() - start;
+
+    printf("%d levels for each of 16 settings of %s.\n", seed_count, stage_names[swept]);
+    printf("Without the memo: %.3f s. With it: %.3f s (%llu stages kept, %llu run, at most %d kept).\n",
+        plain_seconds, memo_seconds, (unsigned long long)memo.hits,
+        (unsigned long long)memo.misses, capacity);
+    printf("Levels %s.\n", plain == memoised ? "the same" : "DIFFERENT");
+    free_stage_memo(&memo);
+    return plain != memoised;
+}
+
+#endif
@@ -0,0 +1,292 @@
+/*
+    metrics.c
+    Numbers that describe each level, kept in a file beside a set of levels, for finding levels by them.
+
+    Each level is measured as it is made: how long the walk from the player
+    to the key and on to the exit is, how many of each entity there are, how
+    much floor there is and how much of it can be reached, and how many rooms
+    and corridors it splits into (see segment.c).
+
+    The file stores each metric in a column, the value for every level one
+    after another, so finding levels by one metric only reads that metric.
+    Each column also has a zone map: the lowest and highest value in each
+    block of METRICS_BLOCK levels, so a search can skip whole blocks that
+    cannot match, and take whole blocks that all match, without reading them.
+    See query.c for searching it.
+
+    Include with NO_MAIN defined.
+    POSIX only.
+*/
+
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "segment.c"
+
+#define METRICS_MAGIC 0x5254454d
+#define METRICS_VERSION 1
+// Levels in each block of the zone maps.
+#define METRICS_BLOCK 4096
+// Walk length when there is no way from the player to the keys and the exit.
+#define NO_PATH 0xffff
+
+enum {
+    METRIC_PATH,
+    METRIC_GOLD,
+    METRIC_ENEMIES,
+    METRIC_SPIKES,
+    METRIC_KEYS,
+    METRIC_FLOOR,
+    METRIC_REACHABLE,
+    METRIC_ROOMS,
+    METRIC_CORRIDORS,
+    METRIC_COUNT
+};
+
+char * metric_names[METRIC_COUNT] = {
+    "path", "gold", "enemies", "spikes", "keys", "floor", "reachable", "rooms", "corridors",
+};
+
+typedef struct {
+    u32 magic, version;
+    u64 level_count;
+    u32 column_count, block_size;
+} Metrics_Header;
+
+typedef struct {
+    char name[16];
+    // Where the values and the zone map start in the file. The zone map is a
+    // lowest and highest value for each block.
+    u64 values, zones;
+} Metrics_Column;
+
+// The metrics of a set of levels while they are being made.
+typedef struct {
+    s64 level_count;
+    u16 * columns[METRIC_COUNT];
+} Metrics_Table;
+
+typedef struct {
+    int file;
+    u8 * base;
+    size_t size;
+    u64 level_count;
+    u32 block_size, column_count;
+    Metrics_Column * columns;
+} Metrics_File;
+
+bool is_walkable_tile(Tile tile) {
+    return (tile & (BIT(FLOOR) | BIT(WALL) | BIT(SPIKES))) == BIT(FLOOR);
+}
+
+// Finds the number of steps from 'start' to every walkable tile, or NO_PATH.
+// Returns the number of tiles reached.
+int walk_distances(Level level, int start, u16 * distance) {
+    u16 queue[LEVEL_SIZE * LEVEL_SIZE];
+    for (int i = 0; i < LEVEL_SIZE * LEVEL_SIZE; ++i) distance[i] = NO_PATH;
+    int head = 0, tail = 0;
+    distance[start] = 0;
+    queue[tail++] = start;
+    while (head < tail) {
+        int tile = queue[head++];
+        int x = tile % LEVEL_SIZE, y = tile / LEVEL_SIZE;
+        int neighbours[4] = { tile - LEVEL_SIZE, tile + LEVEL_SIZE, tile - 1, tile + 1 };
+        bool inside[4] = { y > 0, y < LEVEL_SIZE - 1, x > 0, x < LEVEL_SIZE - 1 };
+        for (int n = 0; n < 4; ++n) {
+            int next = neighbours[n];
+            if (!inside[n] || distance[next] != NO_PATH || !is_walkable_tile(level[next])) continue;
+            distance[next] = distance[tile] + 1;
+            queue[tail++] = next;
+        }
+    }
+    return tail;
+}
+
+// Steps from the player to every key and then to the exit. With more than
+// one key, the nearest key not yet collected is always taken next, which is
+// not always the shortest way round, but is how a player would tend to go.
+int walk_length(Level level, int player, u16 * distance) {
+    int keys[LEVEL_SIZE * LEVEL_SIZE];
+    int key_count = 0, exit = -1;
+    for (int i = 0; i < LEVEL_SIZE * LEVEL_SIZE; ++i) {
+        if (level[i] & BIT(KEY)) keys[key_count++] = i;
+        if (level[i] & BIT(EXIT)) exit = i;
+    }
+    if (exit < 0) return NO_PATH;
+
+    int length = 0, at = player;
+    while (key_count > 0) {
+        walk_distances(level, at, distance);
+        int nearest = 0;
+        for (int k = 1; k < key_count; ++k) {
+            if (distance[keys[k]] < distance[keys[nearest]]) nearest = k;
+        }
+        if (distance[keys[nearest]] == NO_PATH) return NO_PATH;
+        length += distance[keys[nearest]];
+        at = keys[nearest];
+        keys[nearest] = keys[--key_count];
+    }
+    walk_distances(level, at, distance);
+    if (distance[exit] == NO_PATH) return NO_PATH;
+    return MIN(NO_PATH - 1, length + distance[exit]);
+}
+
+// Measures a level, putting each of its METRIC_COUNT metrics in 'metrics'.
+void measure_level(Level level, u16 * metrics) {
+    memset(metrics, 0, sizeof(u16) * METRIC_COUNT);
+    int player = -1;
+    for (int i = 0; i < LEVEL_SIZE * LEVEL_SIZE; ++i) {
+        Tile tile = level[i];
+        if (tile & BIT(PLAYER)) player = i;
+        metrics[METRIC_GOLD]    += (tile >> GOLD) & 1;
+        metrics[METRIC_ENEMIES] += (tile >> ENEMY) & 1;
+        metrics[METRIC_SPIKES]  += (tile >> SPIKES) & 1;
+        metrics[METRIC_KEYS]    += (tile >> KEY) & 1;
+        metrics[METRIC_FLOOR]   += is_walkable_tile(tile);
+    }
+
+    metrics[METRIC_PATH] = NO_PATH;
+    if (player >= 0) {
+        u16 distance[LEVEL_SIZE * LEVEL_SIZE];
+        metrics[METRIC_REACHABLE] = walk_distances(level, player, distance);
+        metrics[METRIC_PATH] = walk_length(level, player, distance);
+    }
+
+    Segmentation segmentation;
+    if (segment_level(level, &segmentation)) {
+        metrics[METRIC_ROOMS] = segmentation.room_count;
+        metrics[METRIC_CORRIDORS] = segmentation.region_count - segmentation.room_count;
+        free_segmentation(&segmentation);
+    }
+}
+
+bool make_metrics_table(Metrics_Table * table, s64 level_count) {
+    *table = (Metrics_Table){ level_count };
+    for (int m = 0; m < METRIC_COUNT; ++m) {
+        table->columns[m] = calloc(MAX(1, level_count), sizeof(u16));
+        if (!table->columns[m]) {
+            for (int f = 0; f < m; ++f) free(table->columns[f]);
+            return false;
+        }
+    }
+    return true;
+}
+
+void free_metrics_table(Metrics_Table * table) {
+    for (int m = 0; m < METRIC_COUNT; ++m) free(table->columns[m]);
+    *table = (Metrics_Table){0};
+}
+
+void set_level_metrics(Metrics_Table * table, s64 index, u16 * metrics) {
+    for (int m = 0; m < METRIC_COUNT; ++m) table->columns[m][index] = metrics[m];
+}
+
+// Writes the columns and their zone maps. Returns false if it could not.
+bool write_metrics_file(char * path, Metrics_Table * table) {
+    FILE * file = fopen(path, "wb");
+    if (!file) return false;
+    u64 level_count = table->level_count;
+    u64 block_count = (level_count + METRICS_BLOCK - 1) / METRICS_BLOCK;
+    u16 * zones = malloc(sizeof(u16) * 2 * MAX(1, block_count));
+    bool ok = zones != NULL;
+
+    Metrics_Header header = { METRICS_MAGIC, METRICS_VERSION, level_count, METRIC_COUNT, METRICS_BLOCK };
+    Metrics_Column columns[METRIC_COUNT] = {0};
+    // Each column starts on a 64 byte boundary, so loads from it line up.
+    #define ALIGN_64(n) (((n) + 63) & ~(u64)63)
+    u64 offset = ALIGN_64(sizeof(header) + sizeof(columns));
+    for (int m = 0; m < METRIC_COUNT; ++m) {
+        strncpy(columns[m].name, metric_names[m], sizeof(columns[m].name) - 1);
+        columns[m].values = offset;
+        columns[m].zones = ALIGN_64(offset + level_count * sizeof(u16));
+        offset = ALIGN_64(columns[m].zones + block_count * 2 * sizeof(u16));
+    }
+    ok = ok && fwrite(&header, sizeof(header), 1, file) && fwrite(columns, sizeof(columns), 1, file);
+
+    u8 padding[64] = {0};
+    u64 at = sizeof(header) + sizeof(columns);
+    for (int m = 0; ok && m < METRIC_COUNT; ++m) {
+        u16 * values = table->columns[m];
+        for (u64 b = 0; b < block_count; ++b) {
+            u16 low = 0xffff, high = 0;
+            u64 end = MIN(level_count, (b + 1) * METRICS_BLOCK);
+            for (u64 i = b * METRICS_BLOCK; i < end; ++i) {
+                low = MIN(low, values[i]);
+                high = MAX(high, values[i]);
+            }
+            zones[2 * b] = low;
+            zones[2 * b + 1] = high;
+        }
+        ok = ok && fwrite(padding, 1, columns[m].values - at, file) == columns[m].values - at;
+        ok = ok && fwrite(values, sizeof(u16), level_count, file) == level_count;
+        at = columns[m].values + level_count * sizeof(u16);
+        ok = ok && fwrite(padding, 1, columns[m].zones - at, file) == columns[m].zones - at;
+        ok = ok && fwrite(zones, sizeof(u16) * 2, block_count, file) == block_count;
+        at = columns[m].zones + block_count * 2 * sizeof(u16);
+    }
+    #undef ALIGN_64
+
+    free(zones);
+    if (fclose(file) != 0) ok = false;
+    return ok;
+}
+
+// Maps a metrics file into memory, so columns are only read as they are used.
+bool open_metrics_file(Metrics_File * metrics, char * path) {
+    *metrics = (Metrics_File){ .file = -1 };
+    metrics->file = open(path, O_RDONLY);
+    if (metrics->file < 0) return false;
+    off_t size = lseek(metrics->file, 0, SEEK_END);
+    if (size < (off_t)sizeof(Metrics_Header)) goto fail;
+    metrics->size = size;
+    metrics->base = mmap(NULL, metrics->size, PROT_READ, MAP_SHARED, metrics->file, 0);
+    if (metrics->base == MAP_FAILED) goto fail;
+
+    Metrics_Header * header = (Metrics_Header *)metrics->base;
+    if (header->magic != METRICS_MAGIC || header->version != METRICS_VERSION) goto fail;
+    metrics->level_count = header->level_count;
+    metrics->block_size = header->block_size;
+    metrics->column_count = header->column_count;
+    metrics->columns = (Metrics_Column *)(metrics->base + sizeof(Metrics_Header));
+    // Everything read from the file is checked to fit in it, in ways that
+    // cannot overflow, so a damaged file is turned away here.
+    if (metrics->block_size == 0 || metrics->block_size > INT_MAX) goto fail;
+    u64 room = metrics->size - sizeof(Metrics_Header);
+    if (metrics->column_count > room / sizeof(Metrics_Column)) goto fail;
+    u64 block_count = metrics->level_count / metrics->block_size
+        + (metrics->level_count % metrics->block_size != 0);
+    for (u32 c = 0; c < metrics->column_count; ++c) {
+        Metrics_Column * column = &metrics->columns[c];
+        if (column->values > metrics->size || column->zones > metrics->size) goto fail;
+        if ((metrics->size - column->values) / sizeof(u16) < metrics->level_count) goto fail;
+        if ((metrics->size - column->zones) / (2 * sizeof(u16)) < block_count) goto fail;
+    }
+    return true;
+
+fail:
+    if (metrics->base && metrics->base != MAP_FAILED) munmap(metrics->base, metrics->size);
+    close(metrics->file);
+    *metrics = (Metrics_File){ .file = -1 };
+    return false;
+}
+
+void close_metrics_file(Metrics_File * metrics) {
+    if (metrics->base) munmap(metrics->base, metrics->size);
+    if (metrics->file >= 0) close(metrics->file);
+    *metrics = (Metrics_File){ .file = -1 };
+}
+
+// Finds a column by name, giving its values and zone map.
+// Returns false if there is no column with that name.
+bool find_metric_column(Metrics_File * metrics, char * name, u16 ** values, u16 ** zones) {
+    for (u32 c = 0; c < metrics->column_count; ++c) {
+        Metrics_Column * column = &metrics->columns[c];
+        if (strncmp(column->name, name, sizeof(column->name)) != 0) continue;
+        *values = (u16 *)(metrics->base + column->values);
+        *zones = (u16 *)(metrics->base + column->zones);
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,336 @@
+/*
+    noise.c
+    Terrain generator using fractal value noise.
+
+    The scatter generator uses white noise, where every tile is picked on its
+    own, so it gives speckle. Value noise picks random values on a coarse grid
+    and blends smoothly between them, so nearby tiles get similar values and
+    the walls form caves and islands. Several octaves are added together, each
+    with twice the detail and less weight than the one before.
+
+    Noise is made a row at a time, 8 tiles at once with AVX2 where the
+    processor has it, 4 at once with SSE2 otherwise, and one at a time on
+    other processors. Every tile goes through the same float steps in the same
+    order whichever way it is made, so the same seed gives the same map on any
+    processor, as long as it is not built with -ffast-math.
+
+    Build with `cc -O2 noise.c -o noise -pthread`.
+    Run with `./noise width height [seed] [threads] > out.map`.
+*/
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "common.c"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+typedef struct {
+    u32 seed;
+    int octaves;
+    // Size in tiles of the biggest features.
+    float period;
+    // How much weight each octave has compared to the one before.
+    float persistence;
+    // Tiles with noise above this become wall, the rest floor. Noise is between 0 and 1.
+    float threshold;
+} Noise;
+
+#define DEFAULT_NOISE (Noise){ 1, 4, 16.0f, 0.5f, 0.55f }
+
+// Constants for hashing a grid point into a random value.
+#define NOISE_PRIME_X 0x27d4eb2du
+#define NOISE_PRIME_Y 0x165667b1u
+#define NOISE_MIX     0x2c1b3c6du
+#define NOISE_OCTAVE  0x9e3779b9u
+
+// Everything about an octave that is the same along a row.
+typedef struct {
+    float frequency, amplitude;
+    // Hash of the grid rows above and below the row of tiles.
+    u32 hash_y0, hash_y1;
+    // How far the row is from the grid row above, smoothed.
+    float smooth_y;
+} Noise_Octave;
+
+Noise_Octave noise_octave(Noise * noise, int octave, int y, float frequency, float amplitude) {
+    float fy = (float)y * frequency;
+    int iy = (int)fy;
+    float ty = fy - (float)iy;
+    u32 seed = noise->seed + octave * NOISE_OCTAVE;
+    return (Noise_Octave){
+        frequency, amplitude,
+        iy * NOISE_PRIME_Y + seed,
+        (iy + 1) * NOISE_PRIME_Y + seed,
+        ty * ty * (3.0f - 2.0f * ty),
+    };
+}
+
+// Gets a random value between 0 and 1 for a grid point, from the sum of its
+// hashed x and y.
+float noise_hash(u32 h) {
+    h ^= h >> 15;
+    h *= NOISE_MIX;
+    h ^= h >> 13;
+    return (float)(h >> 8) * (1.0f / 16777216.0f);
+}
+
+// Works out the noise for 'count' tiles along row 'y', starting at 'x0'.
+// Coordinates are never negative, so truncating is the same as rounding down.
+void noise_row_scalar(Noise * noise, Noise_Octave * octaves, float scale, int x0, int count, float * out) {
+    for (int i = 0; i < count; ++i) {
+        float total = 0;
+        for (int o = 0; o < noise->octaves; ++o) {
+            Noise_Octave * octave = &octaves[o];
+            float fx = (float)(x0 + i) * octave->frequency;
+            int ix = (int)fx;
+            float tx = fx - (float)ix;
+            float sx = tx * tx * (3.0f - 2.0f * tx);
+            u32 hx0 = (u32)ix * NOISE_PRIME_X;
+            u32 hx1 = hx0 + NOISE_PRIME_X;
+            float v00 = noise_hash(hx0 + octave->hash_y0);
+            float v10 = noise_hash(hx1 + octave->hash_y0);
+            float v01 = noise_hash(hx0 + octave->hash_y1);
+            float v11 = noise_hash(hx1 + octave->hash_y1);
+            float top    = v00 + (v10 - v00) * sx;
+            float bottom = v01 + (v11 - v01) * sx;
+            float value  = top + (bottom - top) * octave->smooth_y;
+            total = total + value * octave->amplitude;
+        }
+        out[i] = total * scale;
+    }
+}
+
+#if defined(__x86_64__)
+
+// SSE2 has no 32 bit multiply that keeps the low half, so it is made from two
+// 64 bit multiplies of the even and odd lanes.
+__m128i noise_mullo_sse2(__m128i a, __m128i b) {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd  = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+    return _mm_unpacklo_epi32(
+        _mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+        _mm_shuffle_epi32(odd,  _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+__m128 noise_hash_sse2(__m128i h) {
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 15));
+    h = noise_mullo_sse2(h, _mm_set1_epi32(NOISE_MIX));
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 13));
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(h, 8)), _mm_set1_ps(1.0f / 16777216.0f));
+}
+
+void noise_row_sse2(Noise * noise, Noise_Octave * octaves, float scale, int x0, int count, float * out) {
+    int x = 0;
+    for (; x + 4 <= count; x += 4) {
+        __m128 xs = _mm_add_ps(_mm_set1_ps((float)(x0 + x)), _mm_setr_ps(0, 1, 2, 3));
+        __m128 total = _mm_setzero_ps();
+        for (int o = 0; o < noise->octaves; ++o) {
+            Noise_Octave * octave = &octaves[o];
+            __m128 fx = _mm_mul_ps(xs, _mm_set1_ps(octave->frequency));
+            __m128i ix = _mm_cvttps_epi32(fx);
+            __m128 tx = _mm_sub_ps(fx, _mm_cvtepi32_ps(ix));
+            __m128 sx = _mm_mul_ps(_mm_mul_ps(tx, tx), _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_set1_ps(2.0f), tx)));
+            __m128i hx0 = noise_mullo_sse2(ix, _mm_set1_epi32(NOISE_PRIME_X));
+            __m128i hx1 = _mm_add_epi32(hx0, _mm_set1_epi32(NOISE_PRIME_X));
+            __m128i hy0 = _mm_set1_epi32(octave->hash_y0);
+            __m128i hy1 = _mm_set1_epi32(octave->hash_y1);
+            __m128 v00 = noise_hash_sse2(_mm_add_epi32(hx0, hy0));
+            __m128 v10 = noise_hash_sse2(_mm_add_epi32(hx1, hy0));
+            __m128 v01 = noise_hash_sse2(_mm_add_epi32(hx0, hy1));
+            __m128 v11 = noise_hash_sse2(_mm_add_epi32(hx1, hy1));
+            __m128 top    = _mm_add_ps(v00, _mm_mul_ps(_mm_sub_ps(v10, v00), sx));
+            __m128 bottom = _mm_add_ps(v01, _mm_mul_ps(_mm_sub_ps(v11, v01), sx));
+            __m128 value  = _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), _mm_set1_ps(octave->smooth_y)));
+            total = _mm_add_ps(total, _mm_mul_ps(value, _mm_set1_ps(octave->amplitude)));
+        }
+        _mm_storeu_ps(out + x, _mm_mul_ps(total, _mm_set1_ps(scale)));
+    }
+    noise_row_scalar(noise, octaves, scale, x0 + x, count - x, out + x);
+}
+
+__attribute__((target("avx2")))
+__m256 noise_hash_avx2(__m256i h) {
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+    h = _mm256_mullo_epi32(h, _mm256_set1_epi32(NOISE_MIX));
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 13));
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(h, 8)), _mm256_set1_ps(1.0f / 16777216.0f));
+}
+
+__attribute__((target("avx2")))
+void noise_row_avx2(Noise * noise, Noise_Octave * octaves, float scale, int x0, int count, float * out) {
+    int x = 0;
+    for (; x + 8 <= count; x += 8) {
+        __m256 xs = _mm256_add_ps(_mm256_set1_ps((float)(x0 + x)), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));
+        __m256 total = _mm256_setzero_ps();
+        for (int o = 0; o < noise->octaves; ++o) {
+            Noise_Octave * octave = &octaves[o];
+            __m256 fx = _mm256_mul_ps(xs, _mm256_set1_ps(octave->frequency));
+            __m256i ix = _mm256_cvttps_epi32(fx);
+            __m256 tx = _mm256_sub_ps(fx, _mm256_cvtepi32_ps(ix));
+            __m256 sx = _mm256_mul_ps(_mm256_mul_ps(tx, tx), _mm256_sub_ps(_mm256_set1_ps(3.0f), _mm256_mul_ps(_mm256_set1_ps(2.0f), tx)));
+            __m256i hx0 = _mm256_mullo_epi32(ix, _mm256_set1_epi32(NOISE_PRIME_X));
+            __m256i hx1 = _mm256_add_epi32(hx0, _mm256_set1_epi32(NOISE_PRIME_X));
+            __m256i hy0 = _mm256_set1_epi32(octave->hash_y0);
+            __m256i hy1 = _mm256_set1_epi32(octave->hash_y1);
+            __m256 v00 = noise_hash_avx2(_mm256_add_epi32(hx0, hy0));
+            __m256 v10 = noise_hash_avx2(_mm256_add_epi32(hx1, hy0));
+            __m256 v01 = noise_hash_avx2(_mm256_add_epi32(hx0, hy1));
+            __m256 v11 = noise_hash_avx2(_mm256_add_epi32(hx1, hy1));
+            __m256 top    = _mm256_add_ps(v00, _mm256_mul_ps(_mm256_sub_ps(v10, v00), sx));
+            __m256 bottom = _mm256_add_ps(v01, _mm256_mul_ps(_mm256_sub_ps(v11, v01), sx));
+            __m256 value  = _mm256_add_ps(top, _mm256_mul_ps(_mm256_sub_ps(bottom, top), _mm256_set1_ps(octave->smooth_y)));
+            total = _mm256_add_ps(total, _mm256_mul_ps(value, _mm256_set1_ps(octave->amplitude)));
+        }
+        _mm256_storeu_ps(out + x, _mm256_mul_ps(total, _mm256_set1_ps(scale)));
+    }
+    // The last few tiles go through the SSE2 and then the plain version.
+    noise_row_sse2(noise, octaves, scale, x0 + x, count - x, out + x);
+}
+
+#endif
+
+#define MAX_NOISE_OCTAVES 16
+
+// Works out the noise for the first 'width' tiles of row 'y'.
+void noise_row(Noise * noise, int y, int width, float * out) {
+    Noise_Octave octaves[MAX_NOISE_OCTAVES];
+    float frequency = 1.0f / noise->period;
+    float amplitude = 1.0f, amplitude_sum = 0.0f;
+    int octave_count = CLAMP(1, noise->octaves, MAX_NOISE_OCTAVES);
+    for (int o = 0; o < octave_count; ++o) {
+        octaves[o] = noise_octave(noise, o, y, frequency, amplitude);
+        amplitude_sum += amplitude;
+        frequency *= 2.0f;
+        amplitude *= noise->persistence;
+    }
+    Noise clamped = *noise;
+    clamped.octaves = octave_count;
+    float scale = 1.0f / amplitude_sum;
+
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) noise_row_avx2(&clamped, octaves, scale, 0, width, out);
+    else noise_row_sse2(&clamped, octaves, scale, 0, width, out);
+#else
+    noise_row_scalar(&clamped, octaves, scale, 0, width, out);
+#endif
+}
+
+// Turns a row of noise into walls and floor, with walls around the edges of the map.
+void threshold_noise_row(Map * map, int y, float * values, float threshold) {
+    bool edge = y == 0 || y == map->height - 1;
+    for (int x = 0; x < map->width; ++x) {
+        bool wall = edge || x == 0 || x == map->width - 1 || values[x] > threshold;
+        *map_tile(map, x, y) = wall ? BIT(WALL) : BIT(FLOOR);
+    }
+}
+
+typedef struct {
+    Map * map;
+    Noise * noise;
+    _Atomic int next_row;
+} Noise_Work;
+
+// Rows do not depend on each other, so each thread takes the next few rows
+// that have not been started, until none are left.
+#define NOISE_ROWS_PER_TASK 64
+void * noise_thread(void * data) {
+    Noise_Work * work = data;
+    Map * map = work->map;
+    float * values = malloc(sizeof(float) * map->width);
+    if (!values) return NULL;
+    while (true) {
+        int y0 = atomic_fetch_add(&work->next_row, NOISE_ROWS_PER_TASK);
+        if (y0 >= map->height) break;
+        int y1 = MIN(y0 + NOISE_ROWS_PER_TASK, map->height);
+        for (int y = y0; y < y1; ++y) {
+            noise_row(work->noise, y, map->width, values);
+            threshold_noise_row(map, y, values, work->noise->threshold);
+        }
+    }
+    free(values);
+    return data;
+}
+
+// Fills the map with noise terrain, and walls up any floor that cannot be
+// reached from the floor tile nearest the middle. That tile is where the
+// player should start, and is given back in player_x and player_y.
+// The noise is made on 'thread_count' threads, or on this thread if it is 1.
+// Returns false if there was no floor, or not enough memory.
+bool noise_generator(Map * map, Noise * noise, int thread_count, int * player_x, int * player_y) {
+    forget_wall_distance(map);
+    Noise_Work work = { map, noise, 0 };
+    if (thread_count <= 1) {
+        if (!noise_thread(&work)) return false;
+    } else {
+        pthread_t threads[thread_count];
+        bool all_done = true;
+        for (int i = 0; i < thread_count; ++i) pthread_create(&threads[i], NULL, noise_thread, &work);
+        for (int i = 0; i < thread_count; ++i) {
+            void * done;
+            pthread_join(threads[i], &done);
+            if (!done) all_done = false;
+        }
+        if (!all_done) return false;
+    }
+
+    if (!find_middle_floor(map, player_x, player_y)) return false;
+    return wall_up_unreached_floor(map, *player_x, *player_y);
+}
+
+// Level sized version, with the seed taken from the random number generator.
+// 'parameters' can be NULL, or scale the period and the threshold.
+void noise_level_generator(Level level, float * parameters) {
+    Noise noise = DEFAULT_NOISE;
+    noise.seed = random_u64();
+    noise.period = 8.0f;
+    noise.octaves = 3;
+    if (parameters) {
+        noise.period    *= 2 * parameters[0];
+        noise.threshold *= 2 * parameters[1];
+    }
+    Map map = level_as_map(level);
+    int x, y;
+    if (!noise_generator(&map, &noise, 1, &x, &y)) {
+        for (int i = 0; i < LEVEL_SIZE * LEVEL_SIZE; ++i) level[i] = BIT(WALL);
+    }
+}
+
+#ifndef NO_MAIN
+
+#define NO_MAIN
+#include "stream.c"
+
+int main(int argument_count, char ** arguments) {
+    int width  = argument_count > 1 ? atoi(arguments[1]) : LEVEL_SIZE;
+    int height = argument_count > 2 ? atoi(arguments[2]) : LEVEL_SIZE;
+    Noise noise = DEFAULT_NOISE;
+    if (argument_count > 3) noise.seed = strtoul(arguments[3], NULL, 10);
+    int thread_count = argument_count > 4 ? atoi(arguments[4]) : sysconf(_SC_NPROCESSORS_ONLN);
+
+    Map map = make_map(width, height);
+    if (!map.tiles) {
+        fprintf(stderr, "Could not allocate the map.\n");
+        return 1;
+    }
+
+    double start = seconds_now();
+    int player_x, player_y;
+    if (!noise_generator(&map, &noise, thread_count, &player_x, &player_y)) {
+        fprintf(stderr, "Could not generate the map.\n");
+        return 1;
+    }
+    *map_tile(&map, player_x, player_y) |= BIT(PLAYER);
+    double seconds = seconds_now() - start;
+    fprintf(stderr, "Generated %d by %d in %.3f s (%.1f million tiles per second)\n",
+        width, height, seconds, (double)width * height / seconds / 1e6);
+
+    Row_Writer writer;
+    if (!begin_row_writer(&writer, stdout, width, height)) return 1;
+    for (int y = 0; y < height; ++y) write_row(map_tile(&map, 0, y), y, &writer);
+    if (!end_row_writer(&writer)) return 1;
+    free_map(&map);
+}
+
+#endif
@@ -0,0 +1,711 @@
+/*
+    path.c
+    Hierarchical pathfinding for maps that are much bigger than a level.
+
+    The map is split into clusters the size of a level. Wherever two clusters
+    share a walkable border, an entrance is made on each side of it, and the
+    distances between all entrances of a cluster are found ahead of time.
+    A long-range query is then a search over this small graph of entrances,
+    rather than over every tile of the map.
+
+    When tiles in the map are changed, tell the graph with path_tile_changed,
+    and only the touched clusters will be rebuilt before the next query.
+
+    path_distance gives the length of a path. find_path also gives the tiles
+    along it, working them out only as far along as they are asked for, and
+    path_first_step gives just the first step, for enemies that move a step
+    at a time.
+
+    Build with `cc -O2 path.c -o path -lm`.
+    Run with `./path [width] [height] [seed]` to check paths against a
+    breadth first search over every tile, while walls are being changed.
+*/
+
+#include "common.c"
+
+#define CLUSTER_SIZE LEVEL_SIZE
+
+// Each side of a cluster can hold at most CLUSTER_SIZE / 2 entrances.
+#define MAX_CLUSTER_NODES (4 * (CLUSTER_SIZE / 2 + 1))
+
+// Walkable runs at least this long get an entrance at both ends,
+// shorter runs get a single entrance in the middle.
+#define LONG_ENTRANCE 6
+
+#define PATH_UNREACHABLE 0xffff
+
+typedef struct {
+    int node_count;
+    // Position of each entrance tile, relative to the top left of the cluster.
+    u8 node_x[MAX_CLUSTER_NODES];
+    u8 node_y[MAX_CLUSTER_NODES];
+    // Shortest path inside the cluster between each pair of entrances.
+    // A node_count * node_count table, PATH_UNREACHABLE if there is none.
+    u16 * distances;
+    bool dirty;
+} Path_Cluster;
+
+// Search state of a single entrance, kept in a small hash table so that a
+// query only costs memory for the entrances that it actually visits.
+typedef struct {
+    u64 id;
+    int g;
+    bool closed;
+    // The node it was reached from, to follow the path back.
+    u64 parent;
+} Path_Visit;
+
+typedef struct {
+    u64 id;
+    int f, g;
+} Path_Open;
+
+typedef struct {
+    Map * map;
+    // Tiles are walkable when (tile & mask) == (target & mask), as in flood.
+    Tile mask, target;
+    int clusters_x, clusters_y;
+    Path_Cluster * clusters;
+    bool any_dirty;
+
+    // Scratch space reused between searches.
+    Path_Visit * visits;
+    int visit_capacity, visit_count;
+    Path_Open * open;
+    int open_capacity, open_count;
+} Path_Graph;
+
+// Stand-in node ids for the goal and start tiles while searching.
+#define GOAL_NODE UINT64_MAX
+#define START_NODE (UINT64_MAX - 1)
+
+bool path_walkable(Path_Graph * graph, int x, int y) {
+    return (*map_tile(graph->map, x, y) & graph->mask) == (graph->target & graph->mask);
+}
+
+// Finds the entrances along one side of a cluster. Side is one of the
+// direction constants. Both clusters that share a border use this, so that
+// they agree on where the entrances are. The positions written out are the
+// offsets along the border. Returns the number of entrances found.
+int border_entrances(Path_Graph * graph, int cx, int cy, int side, int * offsets) {
+    int x0 = cx * CLUSTER_SIZE;
+    int y0 = cy * CLUSTER_SIZE;
+    int w = MIN(CLUSTER_SIZE, graph->map->width  - x0);
+    int h = MIN(CLUSTER_SIZE, graph->map->height - y0);
+
+    // The tile on this side, and the tile over the border from it.
+    int ax, ay, bx, by, step_x, step_y, length;
+    if (side == UP) {
+        if (cy == 0) return 0;
+        ax = x0; ay = y0; bx = x0; by = y0 - 1; step_x = 1; step_y = 0; length = w;
+    } else if (side == DOWN) {
+        if (cy == graph->clusters_y - 1) return 0;
+        ax = x0; ay = y0 + h - 1; bx = x0; by = y0 + h; step_x = 1; step_y = 0; length = w;
+    } else if (side == LEFT) {
+        if (cx == 0) return 0;
+        ax = x0; ay = y0; bx = x0 - 1; by = y0; step_x = 0; step_y = 1; length = h;
+    } else {
+        if (cx == graph->clusters_x - 1) return 0;
+        ax = x0 + w - 1; ay = y0; bx = x0 + w; by = y0; step_x = 0; step_y = 1; length = h;
+    }
+
+    int count = 0;
+    int run_start = -1;
+    for (int i = 0; i <= length; ++i) {
+        bool open = i < length
+            && path_walkable(graph, ax + i * step_x, ay + i * step_y)
+            && path_walkable(graph, bx + i * step_x, by + i * step_y);
+        if (open && run_start < 0) {
+            run_start = i;
+        } else if (!open && run_start >= 0) {
+            int run_length = i - run_start;
+            if (run_length >= LONG_ENTRANCE) {
+                offsets[count++] = run_start;
+                offsets[count++] = i - 1;
+            } else {
+                offsets[count++] = run_start + run_length / 2;
+            }
+            run_start = -1;
+        }
+    }
+    return count;
+}
+
+// Breadth first search limited to one cluster, starting from a local position.
+// Fills 'distances' with the number of steps to each tile of the cluster.
+void cluster_distances(Path_Graph * graph, int cx, int cy, int start_x, int start_y,
+    u16 distances[CLUSTER_SIZE * CLUSTER_SIZE]) {
+    int x0 = cx * CLUSTER_SIZE;
+    int y0 = cy * CLUSTER_SIZE;
+    int w = MIN(CLUSTER_SIZE, graph->map->width  - x0);
+    int h = MIN(CLUSTER_SIZE, graph->map->height - y0);
+
+    for (int i = 0; i < CLUSTER_SIZE * CLUSTER_SIZE; ++i) distances[i] = PATH_UNREACHABLE;
+
+    u16 queue[CLUSTER_SIZE * CLUSTER_SIZE];
+    int head = 0, tail = 0;
+    if (!path_walkable(graph, x0 + start_x, y0 + start_y)) return;
+    distances[start_x + start_y * CLUSTER_SIZE] = 0;
+    queue[tail++] = start_x + start_y * CLUSTER_SIZE;
+
+    while (head < tail) {
+        int local = queue[head++];
+        int x = local % CLUSTER_SIZE;
+        int y = local / CLUSTER_SIZE;
+        int neighbours[4][2] = { {x, y-1}, {x, y+1}, {x-1, y}, {x+1, y} };
+        for (int n = 0; n < 4; ++n) {
+            int nx = neighbours[n][0];
+            int ny = neighbours[n][1];
+            if (nx < 0 || ny < 0 || nx >= w || ny >= h) continue;
+            int next = nx + ny * CLUSTER_SIZE;
+            if (distances[next] != PATH_UNREACHABLE) continue;
+            if (!path_walkable(graph, x0 + nx, y0 + ny)) continue;
+            distances[next] = distances[local] + 1;
+            queue[tail++] = next;
+        }
+    }
+}
+
+// Finds the entrances of a cluster and the distances between them.
+void rebuild_cluster(Path_Graph * graph, int cx, int cy) {
+    Path_Cluster * cluster = &graph->clusters[cx + cy * graph->clusters_x];
+    int w = MIN(CLUSTER_SIZE, graph->map->width  - cx * CLUSTER_SIZE);
+    int h = MIN(CLUSTER_SIZE, graph->map->height - cy * CLUSTER_SIZE);
+
+    cluster->node_count = 0;
+    for (int side = UP; side <= RIGHT; ++side) {
+        int offsets[CLUSTER_SIZE];
+        int count = border_entrances(graph, cx, cy, side, offsets);
+        for (int i = 0; i < count; ++i) {
+            int x = offsets[i], y = offsets[i];
+            if (side == UP)    y = 0;     else
+            if (side == DOWN)  y = h - 1; else
+            if (side == LEFT)  x = 0;     else
+            if (side == RIGHT) x = w - 1;
+
+            // Corner tiles can be an entrance on two sides; only keep one node.
+            bool duplicate = false;
+            for (int n = 0; n < cluster->node_count; ++n) {
+                if (cluster->node_x[n] == x && cluster->node_y[n] == y) duplicate = true;
+            }
+            if (duplicate) continue;
+
+            cluster->node_x[cluster->node_count] = x;
+            cluster->node_y[cluster->node_count] = y;
+            ++cluster->node_count;
+        }
+    }
+
+    int count = cluster->node_count;
+    free(cluster->distances);
+    cluster->distances = malloc(sizeof(u16) * MAX(1, count * count));
+
+    for (int a = 0; a < count; ++a) {
+        u16 distances[CLUSTER_SIZE * CLUSTER_SIZE];
+        cluster_distances(graph, cx, cy, cluster->node_x[a], cluster->node_y[a], distances);
+        for (int b = 0; b < count; ++b) {
+            cluster->distances[a + b * count] =
+                distances[cluster->node_x[b] + cluster->node_y[b] * CLUSTER_SIZE];
+        }
+    }
+
+    cluster->dirty = false;
+}
+
+// Rebuilds every cluster that has been touched since the last query.
+void refresh_path_graph(Path_Graph * graph) {
+    if (!graph->any_dirty) return;
+    for (int cy = 0; cy < graph->clusters_y; ++cy) {
+        for (int cx = 0; cx < graph->clusters_x; ++cx) {
+            if (graph->clusters[cx + cy * graph->clusters_x].dirty) {
+                rebuild_cluster(graph, cx, cy);
+            }
+        }
+    }
+    graph->any_dirty = false;
+}
+
+// Builds the graph of cluster entrances for a whole map.
+// The map must outlive the graph.
+Path_Graph make_path_graph(Map * map, Tile mask, Tile target) {
+    Path_Graph graph = {0};
+    graph.map = map;
+    graph.mask = mask;
+    graph.target = target;
+    graph.clusters_x = (map->width  + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+    graph.clusters_y = (map->height + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+    graph.clusters = calloc(graph.clusters_x * graph.clusters_y, sizeof(Path_Cluster));
+    for (int i = 0; i < graph.clusters_x * graph.clusters_y; ++i) {
+        graph.clusters[i].dirty = true;
+    }
+    graph.any_dirty = true;
+    refresh_path_graph(&graph);
+    return graph;
+}
+
+void free_path_graph(Path_Graph * graph) {
+    for (int i = 0; i < graph->clusters_x * graph->clusters_y; ++i) {
+        free(graph->clusters[i].distances);
+    }
+    free(graph->clusters);
+    free(graph->visits);
+    free(graph->open);
+    *graph = (Path_Graph){0};
+}
+
+// Must be called after a tile of the map has been changed.
+// Marks the cluster holding it, and any cluster over the border from it,
+// to be rebuilt before the next query.
+void path_tile_changed(Path_Graph * graph, int x, int y) {
+    int cx = x / CLUSTER_SIZE;
+    int cy = y / CLUSTER_SIZE;
+    int lx = x % CLUSTER_SIZE;
+    int ly = y % CLUSTER_SIZE;
+    graph->clusters[cx + cy * graph->clusters_x].dirty = true;
+    if (lx == 0 && cx > 0) {
+        graph->clusters[(cx - 1) + cy * graph->clusters_x].dirty = true;
+    }
+    if ((lx == CLUSTER_SIZE - 1 || x == graph->map->width - 1) && cx < graph->clusters_x - 1) {
+        graph->clusters[(cx + 1) + cy * graph->clusters_x].dirty = true;
+    }
+    if (ly == 0 && cy > 0) {
+        graph->clusters[cx + (cy - 1) * graph->clusters_x].dirty = true;
+    }
+    if ((ly == CLUSTER_SIZE - 1 || y == graph->map->height - 1) && cy < graph->clusters_y - 1) {
+        graph->clusters[cx + (cy + 1) * graph->clusters_x].dirty = true;
+    }
+    graph->any_dirty = true;
+}
+
+// Node ids pack the cluster index and the node index within that cluster.
+u64 node_id(int cluster, int node) {
+    return (u64)cluster * MAX_CLUSTER_NODES + node;
+}
+
+// Finds (or adds) the search state of a node.
+Path_Visit * visit_node(Path_Graph * graph, u64 id) {
+    // Keep the table at most half full.
+    if (graph->visit_count * 2 >= graph->visit_capacity) {
+        Path_Visit * old = graph->visits;
+        int old_capacity = graph->visit_capacity;
+        graph->visit_capacity = MAX(256, old_capacity * 2);
+        graph->visits = malloc(sizeof(Path_Visit) * graph->visit_capacity);
+        for (int i = 0; i < graph->visit_capacity; ++i) graph->visits[i].id = GOAL_NODE;
+        graph->visit_count = 0;
+        for (int i = 0; i < old_capacity; ++i) {
+            if (old[i].id != GOAL_NODE) *visit_node(graph, old[i].id) = old[i];
+        }
+        free(old);
+    }
+
+    u64 mask = graph->visit_capacity - 1;
+    u64 slot = (id * 0x9E3779B97F4A7C15ull) >> 32 & mask;
+    while (graph->visits[slot].id != GOAL_NODE && graph->visits[slot].id != id) {
+        slot = (slot + 1) & mask;
+    }
+    if (graph->visits[slot].id == GOAL_NODE) {
+        graph->visits[slot] = (Path_Visit){ id, INT_MAX, false, START_NODE };
+        ++graph->visit_count;
+    }
+    return &graph->visits[slot];
+}
+
+void push_open(Path_Graph * graph, u64 id, int g, int f) {
+    if (graph->open_count == graph->open_capacity) {
+        graph->open_capacity = MAX(256, graph->open_capacity * 2);
+        graph->open = realloc(graph->open, sizeof(Path_Open) * graph->open_capacity);
+    }
+    // Binary heap ordered by f.
+    int i = graph->open_count++;
+    while (i > 0 && graph->open[(i - 1) / 2].f > f) {
+        graph->open[i] = graph->open[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    graph->open[i] = (Path_Open){ id, f, g };
+}
+
+Path_Open pop_open(Path_Graph * graph) {
+    Path_Open top = graph->open[0];
+    Path_Open last = graph->open[--graph->open_count];
+    int i = 0;
+    while (true) {
+        int child = i * 2 + 1;
+        if (child >= graph->open_count) break;
+        if (child + 1 < graph->open_count && graph->open[child + 1].f < graph->open[child].f) ++child;
+        if (graph->open[child].f >= last.f) break;
+        graph->open[i] = graph->open[child];
+        i = child;
+    }
+    if (graph->open_count) graph->open[i] = last;
+    return top;
+}
+
+// Finds the node of a cluster at the given map position, or -1.
+int find_cluster_node(Path_Graph * graph, int x, int y) {
+    int cluster = x / CLUSTER_SIZE + (y / CLUSTER_SIZE) * graph->clusters_x;
+    Path_Cluster * c = &graph->clusters[cluster];
+    for (int n = 0; n < c->node_count; ++n) {
+        if (c->node_x[n] == x % CLUSTER_SIZE && c->node_y[n] == y % CLUSTER_SIZE) return n;
+    }
+    return -1;
+}
+
+// Searches the graph of entrances for a path between two tiles. Returns its
+// number of steps, or -1 if there is none. The last entrance on the path is
+// written to 'goal_parent', or START_NODE if it goes straight from the start.
+int path_search(Path_Graph * graph, int start_x, int start_y, int goal_x, int goal_y, u64 * goal_parent) {
+    Map * map = graph->map;
+    if (start_x < 0 || start_y < 0 || start_x >= map->width || start_y >= map->height) return -1;
+    if (goal_x  < 0 || goal_y  < 0 || goal_x  >= map->width || goal_y  >= map->height) return -1;
+    if (!path_walkable(graph, start_x, start_y) || !path_walkable(graph, goal_x, goal_y)) return -1;
+
+    refresh_path_graph(graph);
+
+    int start_cx = start_x / CLUSTER_SIZE, start_cy = start_y / CLUSTER_SIZE;
+    int goal_cx  = goal_x  / CLUSTER_SIZE, goal_cy  = goal_y  / CLUSTER_SIZE;
+    int start_cluster = start_cx + start_cy * graph->clusters_x;
+    int goal_cluster  = goal_cx  + goal_cy  * graph->clusters_x;
+
+    u16 from_start[CLUSTER_SIZE * CLUSTER_SIZE];
+    u16 to_goal[CLUSTER_SIZE * CLUSTER_SIZE];
+    cluster_distances(graph, start_cx, start_cy,
+        start_x % CLUSTER_SIZE, start_y % CLUSTER_SIZE, from_start);
+    cluster_distances(graph, goal_cx, goal_cy,
+        goal_x % CLUSTER_SIZE, goal_y % CLUSTER_SIZE, to_goal);
+
+    // Reset the scratch space.
+    for (int i = 0; i < graph->visit_capacity; ++i) graph->visits[i].id = GOAL_NODE;
+    graph->visit_count = 0;
+    graph->open_count = 0;
+
+    int best = INT_MAX;
+    if (start_cluster == goal_cluster) {
+        u16 direct = from_start[goal_x % CLUSTER_SIZE + (goal_y % CLUSTER_SIZE) * CLUSTER_SIZE];
+        if (direct != PATH_UNREACHABLE) best = direct;
+    }
+    *goal_parent = START_NODE;
+    // The goal is not a node, so its best distance so far is kept here.
+    int goal_g = best;
+
+    // Seed the search with every entrance reachable from the start.
+    Path_Cluster * sc = &graph->clusters[start_cluster];
+    for (int n = 0; n < sc->node_count; ++n) {
+        u16 d = from_start[sc->node_x[n] + sc->node_y[n] * CLUSTER_SIZE];
+        if (d == PATH_UNREACHABLE) continue;
+        u64 id = node_id(start_cluster, n);
+        Path_Visit * visit = visit_node(graph, id);
+        if (d < visit->g) {
+            visit->g = d;
+            visit->parent = START_NODE;
+            int x = start_cx * CLUSTER_SIZE + sc->node_x[n];
+            int y = start_cy * CLUSTER_SIZE + sc->node_y[n];
+            push_open(graph, id, d, d + abs(goal_x - x) + abs(goal_y - y));
+        }
+    }
+
+    while (graph->open_count) {
+        Path_Open current = pop_open(graph);
+        if (current.f >= best) break;
+        if (current.id == GOAL_NODE) {
+            best = current.g;
+            break;
+        }
+
+        Path_Visit * visit = visit_node(graph, current.id);
+        if (visit->closed || current.g > visit->g) continue;
+        visit->closed = true;
+
+        int cluster = current.id / MAX_CLUSTER_NODES;
+        int node = current.id % MAX_CLUSTER_NODES;
+        Path_Cluster * c = &graph->clusters[cluster];
+        int cx = cluster % graph->clusters_x;
+        int cy = cluster / graph->clusters_x;
+        int x = cx * CLUSTER_SIZE + c->node_x[node];
+        int y = cy * CLUSTER_SIZE + c->node_y[node];
+
+        // Edge to the goal, if it is in this cluster.
+        if (cluster == goal_cluster) {
+            u16 d = to_goal[c->node_x[node] + c->node_y[node] * CLUSTER_SIZE];
+            if (d != PATH_UNREACHABLE && current.g + d < goal_g) {
+                goal_g = current.g + d;
+                *goal_parent = current.id;
+                push_open(graph, GOAL_NODE, goal_g, goal_g);
+            }
+        }
+
+        // Edges to the other entrances of this cluster.
+        for (int n = 0; n < c->node_count; ++n) {
+            u16 d = c->distances[node + n * c->node_count];
+            if (n == node || d == PATH_UNREACHABLE) continue;
+            u64 id = node_id(cluster, n);
+            Path_Visit * next = visit_node(graph, id);
+            int g = current.g + d;
+            if (g < next->g) {
+                next->g = g;
+                next->parent = current.id;
+                int nx = cx * CLUSTER_SIZE + c->node_x[n];
+                int ny = cy * CLUSTER_SIZE + c->node_y[n];
+                push_open(graph, id, g, g + abs(goal_x - nx) + abs(goal_y - ny));
+            }
+        }
+
+        // Edges over the border to the matching entrance of a neighbouring cluster.
+        int neighbours[4][2] = { {x, y-1}, {x, y+1}, {x-1, y}, {x+1, y} };
+        for (int i = 0; i < 4; ++i) {
+            int nx = neighbours[i][0];
+            int ny = neighbours[i][1];
+            if (nx < 0 || ny < 0 || nx >= map->width || ny >= map->height) continue;
+            int other = nx / CLUSTER_SIZE + (ny / CLUSTER_SIZE) * graph->clusters_x;
+            if (other == cluster) continue;
+            int n = find_cluster_node(graph, nx, ny);
+            if (n < 0) continue;
+            u64 id = node_id(other, n);
+            Path_Visit * next = visit_node(graph, id);
+            int g = current.g + 1;
+            if (g < next->g) {
+                next->g = g;
+                next->parent = current.id;
+                push_open(graph, id, g, g + abs(goal_x - nx) + abs(goal_y - ny));
+            }
+        }
+    }
+
+    return best == INT_MAX ? -1 : best;
+}
+
+// Returns the number of steps on the shortest path found between two tiles,
+// or -1 if there is no path. Paths that stay within one cluster are exact;
+// longer paths run through cluster entrances, so they can be a few steps longer
+// than the true shortest path.
+int path_distance(Path_Graph * graph, int start_x, int start_y, int goal_x, int goal_y) {
+    u64 goal_parent;
+    return path_search(graph, start_x, start_y, goal_x, goal_y, &goal_parent);
+}
+
+void node_position(Path_Graph * graph, u64 id, int * x, int * y) {
+    int cluster = id / MAX_CLUSTER_NODES;
+    Path_Cluster * c = &graph->clusters[cluster];
+    *x = (cluster % graph->clusters_x) * CLUSTER_SIZE + c->node_x[id % MAX_CLUSTER_NODES];
+    *y = (cluster / graph->clusters_x) * CLUSTER_SIZE + c->node_y[id % MAX_CLUSTER_NODES];
+}
+
+// Walks between two tiles of the same cluster along a shortest path inside
+// it, adding every tile after the first to the path until it holds
+// 'capacity'. Returns the new number of tiles in the path.
+int walk_in_cluster(Path_Graph * graph, int from_x, int from_y, int to_x, int to_y,
+    int * path_x, int * path_y, int count, int capacity) {
+    int cx = to_x / CLUSTER_SIZE, cy = to_y / CLUSTER_SIZE;
+    int x0 = cx * CLUSTER_SIZE, y0 = cy * CLUSTER_SIZE;
+    int w = MIN(CLUSTER_SIZE, graph->map->width  - x0);
+    int h = MIN(CLUSTER_SIZE, graph->map->height - y0);
+    u16 distances[CLUSTER_SIZE * CLUSTER_SIZE];
+    cluster_distances(graph, cx, cy, to_x - x0, to_y - y0, distances);
+
+    int x = from_x - x0, y = from_y - y0;
+    if (distances[x + y * CLUSTER_SIZE] == PATH_UNREACHABLE) return count;
+    while (distances[x + y * CLUSTER_SIZE] > 0 && count < capacity) {
+        // Step to any neighbour one closer to the target.
+        int neighbours[4][2] = { {x, y-1}, {x, y+1}, {x-1, y}, {x+1, y} };
+        for (int n = 0; n < 4; ++n) {
+            int nx = neighbours[n][0];
+            int ny = neighbours[n][1];
+            if (nx < 0 || ny < 0 || nx >= w || ny >= h) continue;
+            if (distances[nx + ny * CLUSTER_SIZE] + 1 != distances[x + y * CLUSTER_SIZE]) continue;
+            x = nx;
+            y = ny;
+            break;
+        }
+        path_x[count] = x0 + x;
+        path_y[count] = y0 + y;
+        ++count;
+    }
+    return count;
+}
+
+// Finds the same path as path_distance, and writes the first 'capacity'
+// tiles along it to 'path_x' and 'path_y', not counting the start. Only
+// the part of the path written out is worked out tile by tile, so asking
+// for a few tiles costs little more than path_distance. Returns the number
+// of steps on the whole path, or -1 if there is none.
+int find_path(Path_Graph * graph, int start_x, int start_y, int goal_x, int goal_y,
+    int * path_x, int * path_y, int capacity) {
+    u64 goal_parent;
+    int length = path_search(graph, start_x, start_y, goal_x, goal_y, &goal_parent);
+    if (length <= 0 || capacity <= 0) return length;
+
+    // The entrances on the path, from the goal back to the start.
+    int node_count = 0, node_capacity = 64;
+    u64 * nodes = malloc(sizeof(u64) * node_capacity);
+    if (!nodes) return -1;
+    for (u64 id = goal_parent; id != START_NODE; id = visit_node(graph, id)->parent) {
+        if (node_count == node_capacity) {
+            node_capacity *= 2;
+            u64 * more = realloc(nodes, sizeof(u64) * node_capacity);
+            if (!more) {
+                free(nodes);
+                return -1;
+            }
+            nodes = more;
+        }
+        nodes[node_count++] = id;
+    }
+
+    // Between entrances in the same cluster, walk inside it; between
+    // clusters, the entrances are next to each other.
+    int count = 0;
+    int x = start_x, y = start_y;
+    for (int i = node_count - 1; i >= -1 && count < capacity; --i) {
+        int next_x = goal_x, next_y = goal_y;
+        if (i >= 0) node_position(graph, nodes[i], &next_x, &next_y);
+        if (x / CLUSTER_SIZE == next_x / CLUSTER_SIZE && y / CLUSTER_SIZE == next_y / CLUSTER_SIZE) {
+            count = walk_in_cluster(graph, x, y, next_x, next_y, path_x, path_y, count, capacity);
+        } else {
+            path_x[count] = next_x;
+            path_y[count] = next_y;
+            ++count;
+        }
+        x = next_x;
+        y = next_y;
+    }
+    free(nodes);
+    return length;
+}
+
+// Gives the direction of the first step from the start towards the goal,
+// for things that move a step at a time, such as enemies. Returns 0 if
+// there is no path, or the start is the goal.
+int path_first_step(Path_Graph * graph, int start_x, int start_y, int goal_x, int goal_y) {
+    int x, y;
+    if (find_path(graph, start_x, start_y, goal_x, goal_y, &x, &y, 1) <= 0) return 0;
+    if (y < start_y) return UP;
+    if (y > start_y) return DOWN;
+    if (x < start_x) return LEFT;
+    return RIGHT;
+}
+
+#ifndef NO_MAIN
+
+// Exact number of steps between two tiles, searching every tile, or -1.
+int map_bfs_distance(Path_Graph * graph, int start_x, int start_y, int goal_x, int goal_y, int * distances, int * queue) {
+    Map * map = graph->map;
+    int tile_count = map->width * map->height;
+    for (int i = 0; i < tile_count; ++i) distances[i] = -1;
+    int head = 0, tail = 0;
+    distances[start_x + start_y * map->width] = 0;
+    queue[tail++] = start_x + start_y * map->width;
+    while (head < tail) {
+        int tile = queue[head++];
+        int x = tile % map->width, y = tile / map->width;
+        if (x == goal_x && y == goal_y) return distances[tile];
+        int neighbours[4][2] = { {x, y-1}, {x, y+1}, {x-1, y}, {x+1, y} };
+        for (int n = 0; n < 4; ++n) {
+            int nx = neighbours[n][0];
+            int ny = neighbours[n][1];
+            if (nx < 0 || ny < 0 || nx >= map->width || ny >= map->height) continue;
+            int next = nx + ny * map->width;
+            if (distances[next] >= 0 || !path_walkable(graph, nx, ny)) continue;
+            distances[next] = distances[tile] + 1;
+            queue[tail++] = next;
+        }
+    }
+    return -1;
+}
+
+void random_walkable_tile(Path_Graph * graph, int * x, int * y) {
+    do {
+        *x = random_int_range(0, graph->map->width - 1);
+        *y = random_int_range(0, graph->map->height - 1);
+    } while (!path_walkable(graph, *x, *y));
+}
+
+// Makes a map of many clusters with walls scattered over it, then in each
+// round changes some walls and checks random paths against a full search:
+// both must agree on whether there is a path, the path found must not be
+// shorter than the true shortest one, and the tiles of the path must be a
+// walk of that many steps to the goal.
+int main(int argument_count, char ** arguments) {
+    int width  = argument_count > 1 ? atoi(arguments[1]) : 20 * CLUSTER_SIZE;
+    int height = argument_count > 2 ? atoi(arguments[2]) : 20 * CLUSTER_SIZE;
+    u64 seed   = argument_count > 3 ? strtoull(arguments[3], NULL, 10) : 1;
+    int rounds = 5, queries = 400, changes = 50;
+    width = MAX(2, width);
+    height = MAX(2, height);
+    reset_seed(seed, 0);
+
+    Map map = make_map(width, height);
+    int * distances = malloc(sizeof(int) * width * height);
+    int * queue = malloc(sizeof(int) * width * height);
+    int * path_x = malloc(sizeof(int) * width * height);
+    int * path_y = malloc(sizeof(int) * width * height);
+    if (!map.tiles || !distances || !queue || !path_x || !path_y) return 1;
+    for (int i = 0; i < width * height; ++i) map.tiles[i] = chance(0.3f) ? BIT(WALL) : BIT(FLOOR);
+
+    Path_Graph graph = make_path_graph(&map, BIT(WALL), 0);
+    int wrong = 0, found = 0;
+    s64 steps = 0, exact_steps = 0;
+    double distance_seconds = 0, path_seconds = 0, bfs_seconds = 0;
+    for (int round = 0; round < rounds; ++round) {
+        if (round > 0) {
+            for (int c = 0; c < changes; ++c) {
+                int x = random_int_range(0, width - 1);
+                int y = random_int_range(0, height - 1);
+                map.tiles[x + y * width] ^= BIT(WALL) | BIT(FLOOR);
+                path_tile_changed(&graph, x, y);
+            }
+        }
+        for (int q = 0; q < queries; ++q) {
+            int start_x, start_y, goal_x, goal_y;
+            random_walkable_tile(&graph, &start_x, &start_y);
+            random_walkable_tile(&graph, &goal_x, &goal_y);
+
+            double start = seconds_now();
+            int distance = path_distance(&graph, start_x, start_y, goal_x, goal_y);
+            distance_seconds += seconds_now() - start;
+            start = seconds_now();
+            int length = find_path(&graph, start_x, start_y, goal_x, goal_y, path_x, path_y, width * height);
+            int direction = path_first_step(&graph, start_x, start_y, goal_x, goal_y);
+            path_seconds += seconds_now() - start;
+            start = seconds_now();
+            int exact = map_bfs_distance(&graph, start_x, start_y, goal_x, goal_y, distances, queue);
+            bfs_seconds += seconds_now() - start;
+
+            bool ok = (length < 0) == (exact < 0) && length >= exact && length == distance;
+            int x = start_x, y = start_y;
+            for (int i = 0; ok && i < length; ++i) {
+                ok = abs(path_x[i] - x) + abs(path_y[i] - y) == 1 && path_walkable(&graph, path_x[i], path_y[i]);
+                if (i == 0) {
+                    int expected = path_y[0] < y ? UP : path_y[0] > y ? DOWN : path_x[0] < x ? LEFT : RIGHT;
+                    ok = ok && direction == expected;
+                }
+                x = path_x[i];
+                y = path_y[i];
+            }
+            if (length >= 0) ok = ok && x == goal_x && y == goal_y;
+            else ok = ok && direction == 0;
+            if (!ok) ++wrong;
+            if (length > 0) {
+                ++found;
+                steps += length;
+                exact_steps += exact;
+            }
+        }
+    }
+
+    int total = rounds * queries;
+    printf("%d paths on a %d by %d map in %d rounds, %d tiles changed between rounds.\n",
+        total, width, height, rounds, changes);
+    printf("Length: %.1f us a path. Every tile and the first step: %.1f us. Full search: %.1f us.\n",
+        distance_seconds / total * 1e6, path_seconds / total * 1e6, bfs_seconds / total * 1e6);
+    printf("%d paths found, %.2f%% longer than the shortest on average.\n",
+        found, 100.0 * (steps - exact_steps) / MAX(1, exact_steps));
+    printf("%s\n", wrong ? "Some paths are WRONG." : "All paths check out.");
+    free_path_graph(&graph);
+    free_map(&map);
+    free(distances);
+    free(queue);
+    free(path_x);
+    free(path_y);
+    return wrong != 0;
+}
+
+#endif
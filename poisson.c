@@ -0,0 +1,270 @@
+/*
+    poisson.c
+    Places gold, enemies and spikes spread out evenly, using Poisson-disk sampling.
+
+    The scatter placer flips a coin for every tile, so entities often end up
+    in clumps, with big empty areas between them. Here every entity type has a
+    minimum distance that entities of that type are kept apart by, which
+    spreads them out evenly but still at random. Entities of different types
+    only have to be half the smaller of their two distances apart, so each
+    type still has room to spread out between the others.
+
+    Uses Bridson's algorithm. New entities are tried in a ring around ones
+    already placed, until no more fit. Placed entities are kept in a grid with
+    cells small enough to hold only one each, so checking a spot only looks at
+    the few cells around it. Spots spread over the whole map are also tried
+    as new starting points, so areas cut off by walls are filled too. The
+    time taken depends on the number of entities placed, not the number of
+    tiles.
+
+    Build with `cc -O2 poisson.c -o poisson -pthread -lm`.
+    Run with `./poisson width height [seed] > out.map`.
+*/
+
+#include "common.c"
+
+typedef struct {
+    // Entity bit that is placed, such as GOLD.
+    int entity;
+    float min_distance;
+} Poisson_Type;
+
+typedef struct {
+    int x, y, type;
+} Poisson_Sample;
+
+#define POISSON_MAX_TYPES 8
+
+typedef struct {
+    Map * map;
+    Poisson_Type * types;
+    int type_count;
+    // Number of spots tried around each entity before giving up on it.
+    int attempts;
+
+    // Square of the distance needed between each pair of types.
+    float needed[POISSON_MAX_TYPES][POISSON_MAX_TYPES];
+    // How many cells either side of a spot have to be checked for each type.
+    int search[POISSON_MAX_TYPES];
+
+    float cell_size;
+    int grid_width, grid_height;
+    // Index of the sample in each cell, or -1.
+    int * grid;
+
+    Poisson_Sample * samples;
+    int sample_count, sample_capacity;
+    // Samples that may still have room around them.
+    int * active;
+    int active_count;
+} Poisson;
+
+// Only empty floor can have an entity put on it.
+// Spikes cannot be walked over, so they are only put where they do not cut
+// off any walkable tiles from each other.
+bool poisson_tile_is_free(Map * map, int x, int y, int entity) {
+    if (x < 1 || y < 1 || x >= map->width - 1 || y >= map->height - 1) return false;
+    if (*map_tile(map, x, y) != BIT(FLOOR)) return false;
+    if (entity != SPIKES) return true;
+
+    int ring_offsets[8][2] = { {0,-1}, {1,-1}, {1,0}, {1,1}, {0,1}, {-1,1}, {-1,0}, {-1,-1} };
+    u8 ring = 0;
+    for (int i = 0; i < 8; ++i) {
+        Tile t = *map_tile(map, x + ring_offsets[i][0], y + ring_offsets[i][1]);
+        if ((t & (BIT(WALL) | BIT(SPIKES))) == 0) ring |= BIT(i);
+    }
+    return !is_local_cut(ring);
+}
+
+// Checks that a spot is free and far enough from every entity placed so far.
+bool poisson_fits(Poisson * poisson, int x, int y, int type) {
+    if (!poisson_tile_is_free(poisson->map, x, y, poisson->types[type].entity)) return false;
+    int cx = x / poisson->cell_size;
+    int cy = y / poisson->cell_size;
+    int search = poisson->search[type];
+    int y0 = MAX(0, cy - search), y1 = MIN(poisson->grid_height - 1, cy + search);
+    int x0 = MAX(0, cx - search), x1 = MIN(poisson->grid_width - 1, cx + search);
+    for (int gy = y0; gy <= y1; ++gy) {
+        int * row = &poisson->grid[gy * poisson->grid_width];
+        for (int gx = x0; gx <= x1; ++gx) {
+            if (row[gx] < 0) continue;
+            Poisson_Sample * other = &poisson->samples[row[gx]];
+            if (sq(other->x - x) + sq(other->y - y) < poisson->needed[type][other->type]) return false;
+        }
+    }
+    return true;
+}
+
+bool poisson_add(Poisson * poisson, int x, int y, int type) {
+    if (poisson->sample_count == poisson->sample_capacity) {
+        int capacity = MAX(64, poisson->sample_capacity * 2);
+        Poisson_Sample * samples = realloc(poisson->samples, sizeof(Poisson_Sample) * capacity);
+        int * active = realloc(poisson->active, sizeof(int) * capacity);
+        if (samples) poisson->samples = samples;
+        if (active) poisson->active = active;
+        if (!samples || !active) return false;
+        poisson->sample_capacity = capacity;
+    }
+    int index = poisson->sample_count++;
+    poisson->samples[index] = (Poisson_Sample){ x, y, type };
+    poisson->active[poisson->active_count++] = index;
+    int cx = x / poisson->cell_size;
+    int cy = y / poisson->cell_size;
+    poisson->grid[cx + cy * poisson->grid_width] = index;
+    *map_tile(poisson->map, x, y) |= BIT(poisson->types[type].entity);
+    return true;
+}
+
+// Tries spots in a ring around each active entity, between one and two
+// minimum distances away, until no active entities are left.
+// Returns false if there was not enough memory.
+bool poisson_grow(Poisson * poisson, int type) {
+    float distance = poisson->types[type].min_distance;
+    while (poisson->active_count) {
+        int a = random_int_range(0, poisson->active_count - 1);
+        Poisson_Sample from = poisson->samples[poisson->active[a]];
+        bool placed = false;
+        for (int i = 0; i < poisson->attempts && !placed; ++i) {
+            // Pick a spot in the square around the ring, and keep it if it is
+            // in the ring, which is cheaper than using sin and cos.
+            float dx = (random_float() * 4 - 2) * distance;
+            float dy = (random_float() * 4 - 2) * distance;
+            float d = dx * dx + dy * dy;
+            if (d < distance * distance || d > 4 * distance * distance) continue;
+            int x = from.x + (int)roundf(dx);
+            int y = from.y + (int)roundf(dy);
+            if (poisson_fits(poisson, x, y, type)) {
+                if (!poisson_add(poisson, x, y, type)) return false;
+                placed = true;
+            }
+        }
+        // No room around this entity, so it stops being active.
+        if (!placed) poisson->active[a] = poisson->active[--poisson->active_count];
+    }
+    return true;
+}
+
+// Places the entity types in the order given, so give the ones with the
+// largest distances first, or the smaller ones fill the gaps they need.
+// 'attempts' is the number of spots tried around each entity, 30 is usual.
+// Returns the number of entities placed, or -1 if there was not enough memory.
+int poisson_placer_map(Map * map, Poisson_Type * types, int type_count, int attempts) {
+    if (type_count <= 0) return 0;
+    type_count = MIN(type_count, POISSON_MAX_TYPES);
+    Poisson poisson = { map, types, type_count, attempts };
+
+    float smallest = FLT_MAX;
+    for (int a = 0; a < type_count; ++a) {
+        for (int b = 0; b < type_count; ++b) {
+            float distance = types[a].min_distance;
+            if (a != b) distance = MIN(types[a].min_distance, types[b].min_distance) / 2;
+            distance = MAX(1.0f, distance);
+            poisson.needed[a][b] = distance * distance;
+            smallest = MIN(smallest, distance);
+        }
+    }
+
+    // Any two points in a cell this size are closer than the smallest distance,
+    // so each cell holds at most one entity.
+    poisson.cell_size = smallest / sqrtf(2);
+    poisson.grid_width  = ceilf(map->width / poisson.cell_size) + 1;
+    poisson.grid_height = ceilf(map->height / poisson.cell_size) + 1;
+    for (int a = 0; a < type_count; ++a) {
+        poisson.search[a] = ceilf(MAX(1.0f, types[a].min_distance) / poisson.cell_size);
+    }
+    size_t cell_count = (size_t)poisson.grid_width * poisson.grid_height;
+    poisson.grid = malloc(sizeof(int) * cell_count);
+    if (!poisson.grid) return -1;
+    for (size_t i = 0; i < cell_count; ++i) poisson.grid[i] = -1;
+
+    for (int type = 0; type < type_count; ++type) {
+        // Try one spot in every square the size of the type's distance, to
+        // start new areas wherever there is room, and grow each one.
+        float step = MAX(1.0f, types[type].min_distance);
+        for (float sy = 0; sy < map->height; sy += step) {
+            for (float sx = 0; sx < map->width; sx += step) {
+                int x = sx + random_float() * step;
+                int y = sy + random_float() * step;
+                if (!poisson_fits(&poisson, x, y, type)) continue;
+                if (!poisson_add(&poisson, x, y, type)) goto out_of_memory;
+                if (!poisson_grow(&poisson, type)) goto out_of_memory;
+            }
+        }
+    }
+
+    free(poisson.grid);
+    free(poisson.samples);
+    free(poisson.active);
+    return poisson.sample_count;
+
+out_of_memory:
+    free(poisson.grid);
+    free(poisson.samples);
+    free(poisson.active);
+    return -1;
+}
+
+// Spreads gold, enemies and spikes around a level. Any that are already in
+// the level are taken out first, so it can follow a placer such as the
+// chokepoint placer, and keep the player, key and exit that it placed.
+// Spikes never cut off one part of the level from another, so a completable
+// level stays completable.
+// 'parameters' can be NULL, or scale the distances between the gold, enemies and spikes.
+void poisson_placer(Level level, float * parameters) {
+    Poisson_Type types[] = {
+        { ENEMY,  6.0f },
+        { SPIKES, 5.0f },
+        { GOLD,   3.5f },
+    };
+    if (parameters) {
+        types[2].min_distance *= 2 * parameters[0];
+        types[0].min_distance *= 2 * parameters[1];
+        types[1].min_distance *= 2 * parameters[2];
+    }
+    for (int i = 0; i < LEVEL_SIZE * LEVEL_SIZE; ++i) {
+        level[i] &= ~(BIT(GOLD) | BIT(ENEMY) | BIT(SPIKES));
+    }
+    Map map = level_as_map(level);
+    poisson_placer_map(&map, types, 3, 30);
+}
+
+#ifndef NO_MAIN
+
+#define NO_MAIN
+#include "noise.c"
+#include "stream.c"
+
+int main(int argument_count, char ** arguments) {
+    int width  = argument_count > 1 ? atoi(arguments[1]) : LEVEL_SIZE;
+    int height = argument_count > 2 ? atoi(arguments[2]) : LEVEL_SIZE;
+    Noise noise = DEFAULT_NOISE;
+    if (argument_count > 3) noise.seed = strtoul(arguments[3], NULL, 10);
+    reset_seed(noise.seed, 0);
+
+    Map map = make_map(width, height);
+    int player_x, player_y;
+    if (!map.tiles || !noise_generator(&map, &noise, sysconf(_SC_NPROCESSORS_ONLN), &player_x, &player_y)) {
+        fprintf(stderr, "Could not generate the map.\n");
+        return 1;
+    }
+    *map_tile(&map, player_x, player_y) |= BIT(PLAYER);
+
+    Poisson_Type types[] = { { ENEMY, 6.0f }, { SPIKES, 5.0f }, { GOLD, 3.5f } };
+    double start = seconds_now();
+    int placed = poisson_placer_map(&map, types, 3, 30);
+    double seconds = seconds_now() - start;
+    if (placed < 0) {
+        fprintf(stderr, "Not enough memory to place entities.\n");
+        return 1;
+    }
+    fprintf(stderr, "Placed %d entities in %.3f s (%.1f million per second)\n",
+        placed, seconds, placed / seconds / 1e6);
+
+    Row_Writer writer;
+    if (!begin_row_writer(&writer, stdout, width, height)) return 1;
+    for (int y = 0; y < height; ++y) write_row(map_tile(&map, 0, y), y, &writer);
+    if (!end_row_writer(&writer)) return 1;
+    free_map(&map);
+}
+
+#endif
@@ -0,0 +1,80 @@
+/*
+    profiler.c
+    Frame timing overlay for the game and the editor.
+
+    Timings are kept in rings of recent samples, and the overlay shows the
+    median (p50) and 99th percentile (p99) of each, in microseconds.
+    The bitmap font only has digits, so the overlay is a fixed table:
+
+        frame        p50  p99
+        update       p50  p99
+        draw_level   p50  p99
+        draw calls   p50  p99
+*/
+
+#pragma once
+
+#include "graphics.c"
+
+// Number of recent samples that percentiles are taken over.
+#define PROFILE_SAMPLES 128
+
+typedef struct {
+    float samples[PROFILE_SAMPLES];
+    int count, next;
+} Profile_Ring;
+
+typedef struct {
+    Profile_Ring frame;
+    Profile_Ring update;
+    Profile_Ring draw;
+    Profile_Ring draw_calls;
+} Profiler;
+
+void add_sample(Profile_Ring * ring, float sample) {
+    ring->samples[ring->next] = sample;
+    ring->next = (ring->next + 1) % PROFILE_SAMPLES;
+    if (ring->count < PROFILE_SAMPLES) ++ring->count;
+}
+
+int compare_floats(const void * a, const void * b) {
+    float fa = *(const float *)a;
+    float fb = *(const float *)b;
+    return (fa > fb) - (fa < fb);
+}
+
+// Gets the sample that the given portion of samples are at or below.
+float percentile(Profile_Ring * ring, float portion) {
+    if (ring->count == 0) return 0;
+    float sorted[PROFILE_SAMPLES];
+    memcpy(sorted, ring->samples, sizeof(float) * ring->count);
+    qsort(sorted, ring->count, sizeof(float), compare_floats);
+    int index = portion * (ring->count - 1) + 0.5f;
+    return sorted[CLAMP(0, index, ring->count - 1)];
+}
+
+u64 profile_start(void) {
+    return SDL_GetPerformanceCounter();
+}
+
+// Microseconds since 'start'.
+float profile_end(u64 start) {
+    return (SDL_GetPerformanceCounter() - start) * 1000000.0 / SDL_GetPerformanceFrequency();
+}
+
+void draw_profile_row(Profile_Ring * ring, int screen_x, int screen_y) {
+    draw_number(percentile(ring, 0.5f),  screen_x, screen_y);
+    draw_number(percentile(ring, 0.99f), screen_x + 8 * 8, screen_y);
+}
+
+// Draws the overlay in the top right corner of the window.
+void draw_profiler(Profiler * profiler) {
+    int width = 16 * 8;
+    int screen_x = LEVEL_SIZE * SPRITE_SIZE - width;
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderFillRect(renderer, &(SDL_Rect){ screen_x, 0, width, 4 * 10 });
+    draw_profile_row(&profiler->frame,      screen_x, 1);
+    draw_profile_row(&profiler->update,     screen_x, 11);
+    draw_profile_row(&profiler->draw,       screen_x, 21);
+    draw_profile_row(&profiler->draw_calls, screen_x, 31);
+}
@@ -0,0 +1,198 @@
+/*
+    query.c
+    Finds the levels in a set whose metrics are in given ranges.
+
+    Reads the metrics file written beside a set of levels (see metrics.c), and
+    prints the index of every level that matches all of the ranges given, such
+    as `path=40..60 gold=11..` for a walk of 40 to 60 steps and more than 10
+    gold. Either end of a range can be left off.
+
+    Only the columns named are read. For each block of levels, the zone maps
+    are checked first: if any column's values in the block are all out of its
+    range the block is skipped, and a column whose values are all in range is
+    not read. Otherwise the column is checked 16 values at a time with AVX2
+    (8 with SSE2), each giving a bit in a mask of matching levels, and the
+    masks of each column are combined. A column only looks at the groups of
+    64 levels that still have a match in them.
+
+    Build with `cc -O2 query.c -o query -lm`.
+    Run with `./query levels.metrics path=40..60 gold=11.. > indices`.
+*/
+
+#define NO_MAIN
+#include "metrics.c"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+typedef struct {
+    char * name;
+    u16 * values;
+    u16 * zones;
+    u16 low, high;
+} Query_Term;
+
+// Gives a bit for each of 64 values, set if the value is from low to high.
+u64 match_range_scalar(u16 * values, int count, u16 low, u16 high) {
+    u64 match = 0;
+    for (int i = 0; i < count; ++i) {
+        if (values[i] >= low && values[i] <= high) match |= (u64)1 << i;
+    }
+    return match;
+}
+
+#if defined(__x86_64__)
+// A value is in range if value - low is at most high - low, both unsigned.
+// There is no unsigned 16 bit compare, so the top bits are flipped and a
+// signed compare is used, which gives the same order.
+u64 match_range_sse2(u16 * values, u16 low, u16 high) {
+    __m128i flip = _mm_set1_epi16((short)0x8000);
+    __m128i lows = _mm_set1_epi16(low);
+    __m128i span = _mm_xor_si128(_mm_set1_epi16(high - low), flip);
+    u64 outside = 0;
+    for (int i = 0; i < 64; i += 8) {
+        __m128i v = _mm_loadu_si128((__m128i *)&values[i]);
+        __m128i above = _mm_cmpgt_epi16(_mm_xor_si128(_mm_sub_epi16(v, lows), flip), span);
+        outside |= (u64)(_mm_movemask_epi8(_mm_packs_epi16(above, above)) & 0xff) << i;
+    }
+    return ~outside;
+}
+
+__attribute__((target("avx2")))
+u64 match_range_avx2(u16 * values, u16 low, u16 high) {
+    __m256i flip = _mm256_set1_epi16((short)0x8000);
+    __m256i lows = _mm256_set1_epi16(low);
+    __m256i span = _mm256_xor_si256(_mm256_set1_epi16(high - low), flip);
+    u64 outside = 0;
+    for (int i = 0; i < 64; i += 32) {
+        __m256i a = _mm256_loadu_si256((__m256i *)&values[i]);
+        __m256i b = _mm256_loadu_si256((__m256i *)&values[i + 16]);
+        a = _mm256_cmpgt_epi16(_mm256_xor_si256(_mm256_sub_epi16(a, lows), flip), span);
+        b = _mm256_cmpgt_epi16(_mm256_xor_si256(_mm256_sub_epi16(b, lows), flip), span);
+        // Packing works in each half of the register, so put the halves back in order.
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xd8);
+        outside |= (u64)(u32)_mm256_movemask_epi8(packed) << i;
+    }
+    return ~outside;
+}
+#endif
+
+// Ands 'match', a bit for each of 'count' levels, with the levels whose
+// value is in range. Groups of 64 with no matches left are not looked at.
+void match_term(Query_Term * term, u64 first, int count, u64 * match, bool use_avx2) {
+    for (int w = 0; w * 64 < count; ++w) {
+        if (!match[w]) continue;
+        u16 * values = &term->values[first + w * 64];
+        int n = MIN(64, count - w * 64);
+        if (n < 64) {
+            match[w] &= match_range_scalar(values, n, term->low, term->high);
+            continue;
+        }
+#if defined(__x86_64__)
+        if (use_avx2) match[w] &= match_range_avx2(values, term->low, term->high);
+        else match[w] &= match_range_sse2(values, term->low, term->high);
+#else
+        match[w] &= match_range_scalar(values, n, term->low, term->high);
+#endif
+    }
+}
+
+// Reads a range such as 'gold=11..' or 'path=40..60'. Returns false if it is not one.
+bool parse_term(char * text, Query_Term * term) {
+    char * equals = strchr(text, '=');
+    char * dots = equals ? strstr(equals, "..") : NULL;
+    if (!dots) return false;
+    *equals = 0;
+    term->name = text;
+    char * end;
+    long low = strtol(equals + 1, &end, 10);
+    if (end != dots) return false;
+    if (end == equals + 1) low = 0;
+    long high = strtol(dots + 2, &end, 10);
+    if (*end) return false;
+    if (end == dots + 2) high = 0xffff;
+    if (low > high || high < 0 || low > 0xffff) return false;
+    term->low = MAX(0, low);
+    term->high = MIN(0xffff, high);
+    return true;
+}
+
+int main(int argument_count, char ** arguments) {
+    if (argument_count < 3) {
+        fprintf(stderr, "Usage: %s levels.metrics name=low..high ...\n", arguments[0]);
+        return 1;
+    }
+    Metrics_File metrics;
+    if (!open_metrics_file(&metrics, arguments[1])) {
+        fprintf(stderr, "Could not read %s.\n", arguments[1]);
+        return 1;
+    }
+    int term_count = argument_count - 2;
+    Query_Term terms[term_count];
+    for (int t = 0; t < term_count; ++t) {
+        if (!parse_term(arguments[t + 2], &terms[t])) {
+            fprintf(stderr, "Could not understand '%s', expected name=low..high.\n", arguments[t + 2]);
+            return 1;
+        }
+        if (!find_metric_column(&metrics, terms[t].name, &terms[t].values, &terms[t].zones)) {
+            fprintf(stderr, "There is no metric called '%s'.\n", terms[t].name);
+            return 1;
+        }
+    }
+
+    bool use_avx2 = false;
+#if defined(__x86_64__)
+    use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+    u32 block_size = metrics.block_size;
+    u64 * match = malloc(sizeof(u64) * ((block_size + 63) / 64));
+    if (!match) return 1;
+
+    double start = seconds_now();
+    u64 matches = 0, skipped = 0, whole = 0, scanned = 0;
+    for (u64 first = 0, block = 0; first < metrics.level_count; first += block_size, ++block) {
+        int count = MIN(block_size, metrics.level_count - first);
+        int word_count = (count + 63) / 64;
+        bool skip = false, all = true;
+        for (int t = 0; t < term_count && !skip; ++t) {
+            u16 low = terms[t].zones[2 * block], high = terms[t].zones[2 * block + 1];
+            if (high < terms[t].low || low > terms[t].high) skip = true;
+            if (low < terms[t].low || high > terms[t].high) all = false;
+        }
+        if (skip) {
+            ++skipped;
+            continue;
+        }
+
+        for (int w = 0; w < word_count; ++w) match[w] = ~(u64)0;
+        if (count % 64) match[word_count - 1] = ((u64)1 << (count % 64)) - 1;
+        if (all) {
+            ++whole;
+        } else {
+            ++scanned;
+            for (int t = 0; t < term_count; ++t) {
+                u16 low = terms[t].zones[2 * block], high = terms[t].zones[2 * block + 1];
+                // A column that is all in range leaves the matches as they are.
+                if (low >= terms[t].low && high <= terms[t].high) continue;
+                match_term(&terms[t], first, count, match, use_avx2);
+            }
+        }
+
+        for (int w = 0; w < word_count; ++w) {
+            for (u64 bits = match[w]; bits; bits &= bits - 1) {
+                printf("%llu\n", (unsigned long long)(first + w * 64 + __builtin_ctzll(bits)));
+                ++matches;
+            }
+        }
+    }
+    double seconds = seconds_now() - start;
+
+    fprintf(stderr, "%llu of %llu levels match. Blocks: %llu skipped, %llu all matching, %llu scanned.\n",
+        (unsigned long long)matches, (unsigned long long)metrics.level_count,
+        (unsigned long long)skipped, (unsigned long long)whole, (unsigned long long)scanned);
+    fprintf(stderr, "Took %.3f s (%.0f million levels per second).\n",
+        seconds, seconds > 0 ? metrics.level_count / seconds / 1e6 : 0);
+    free(match);
+    close_metrics_file(&metrics);
+}
@@ -0,0 +1,157 @@
+/*
+    rules.c
+    The rules of the game: how the level changes each time the player takes a step.
+
+    Kept apart from game.c, which draws the game and reads the keyboard, so
+    that the same rules can be run without a window, such as by the bot in
+    bot.c.
+*/
+
+#pragma once
+
+#include "delta.c"
+#include "telemetry.c"
+
+// Everything about a game being played, other than the level itself.
+typedef struct {
+    int gold_collected;
+    int enemies_killed;
+    int steps_taken;
+    // If set, every change made by update_level is recorded here.
+    Delta_Log * delta_log;
+    // If set, events from update_level are pushed here.
+    Telemetry * telemetry;
+} Game;
+
+// Events happen during a step, before the caller counts it, so they are
+// stamped with the number the step will have, as its EVENT_STEP is.
+void emit_event(Game * game, int type, int x, int y) {
+    if (game->telemetry) record_event(game->telemetry, (Telemetry_Event){ game->steps_taken + 1, type, x, y, 0 });
+}
+
+// Updates the entire level, stepping the player in the given direction.
+// Returns true if the game has ended for any reason. Counts what happened
+// in 'game', but not the step itself, which is up to the caller.
+bool update_level(Level level, int direction, Game * game) {
+    bool game_over = false;
+
+    // Keep the level as it was, so the changes can be recorded.
+    Level original_level;
+    if (game->delta_log) memcpy(original_level, level, sizeof(Level));
+
+    // Create the level that will replace the old one, starting with all
+    // entities that are unaffected by updates.
+    Level updated_level;
+    for (int i = 0; i < LEVEL_SIZE * LEVEL_SIZE; ++i) {
+        updated_level[i] = level[i] & STATIC_ENTITIES;
+    }
+
+    // First pass through level handles dynamic entities.
+    for (int y = 0; y < LEVEL_SIZE; ++y) {
+        for (int x = 0; x < LEVEL_SIZE; ++x) {
+            Tile tile = level[x + y * LEVEL_SIZE];
+            // Most tiles have nothing on them that moves.
+            if ((tile & (BIT(ENEMY) | BIT(PLAYER))) == 0) continue;
+
+            if (tile & BIT(ENEMY)) {
+                // Move the enemy in a random direction.
+                int new_x = x, new_y = y;
+                int direction = random_int_range(1, 6);
+                if (direction == UP)    --new_y; else
+                if (direction == DOWN)  ++new_y; else
+                if (direction == LEFT)  --new_x; else
+                if (direction == RIGHT) ++new_x;
+
+                // Only succeed if that tile is not solid.
+                if ((level[new_x + new_y * LEVEL_SIZE] & SOLID_ENTITIES) == 0) {
+                    updated_level[new_x + new_y * LEVEL_SIZE] |= BIT(ENEMY);
+                } else {
+                    updated_level[x + y * LEVEL_SIZE] |= BIT(ENEMY);
+                }
+            }
+
+            if (tile & BIT(PLAYER)) {
+                // If the player is already standing on a spider, kill it.
+                if (updated_level[x + y * LEVEL_SIZE] & BIT(ENEMY)) {
+                    updated_level[x + y * LEVEL_SIZE] ^= BIT(ENEMY);
+                    ++game->enemies_killed;
+                    emit_event(game, EVENT_KILL, x, y);
+                }
+
+                // Attempt to move to the new tile.
+                int new_x = x, new_y = y;
+                if (direction == UP)    --new_y; else
+                if (direction == DOWN)  ++new_y; else
+                if (direction == LEFT)  --new_x; else
+                if (direction == RIGHT) ++new_x;
+
+                Tile new_tile = level[new_x + new_y * LEVEL_SIZE];
+
+                // Only succeed if that tile is not solid.
+                if ((new_tile & SOLID_ENTITIES) == 0) {
+                    updated_level[new_x + new_y * LEVEL_SIZE] |= BIT(PLAYER);
+
+                    // Collect any collectables on the new tile.
+                    if (new_tile & BIT(GOLD)) {
+                        level[new_x + new_y * LEVEL_SIZE] ^= BIT(GOLD);
+                        ++game->gold_collected;
+                        emit_event(game, EVENT_GOLD, new_x, new_y);
+                    }
+                    if (new_tile & BIT(KEY)) {
+                        level[new_x + new_y * LEVEL_SIZE] ^= BIT(KEY);
+                        emit_event(game, EVENT_KEY, new_x, new_y);
+                    }
+
+                    // Kill any enemies on the new tile.
+                    if (new_tile & BIT(ENEMY)) {
+                        level[new_x + new_y * LEVEL_SIZE] ^= BIT(ENEMY);
+                        ++game->enemies_killed;
+                        emit_event(game, EVENT_KILL, new_x, new_y);
+                    }
+
+                    // End the game if the player reaches the exit and there
+                    // is not a lock on it.
+                    if (new_tile & BIT(EXIT) && (new_tile & BIT(LOCK)) == 0) {
+                        game_over = true;
+                        emit_event(game, EVENT_EXIT, new_x, new_y);
+                    }
+
+                    // End the game if the player steps onto spikes.
+                    if (new_tile & BIT(SPIKES)) {
+                        game_over = true;
+                        emit_event(game, EVENT_DEATH, new_x, new_y);
+                    }
+                } else {
+                    // Place the player onto their original tile in the updated
+                    // level if they did not move in any direction.
+                    updated_level[x + y * LEVEL_SIZE] |= BIT(PLAYER);
+                }
+            }
+        }
+    }
+
+    // Second pass handles collectables, as they may have been affected by the first pass.
+    // If a key still exists in the stage, then it has not been found.
+    Tile keys_left = 0;
+    for (int i = 0; i < LEVEL_SIZE * LEVEL_SIZE; ++i) {
+        updated_level[i] |= level[i] & (BIT(GOLD) | BIT(KEY));
+        keys_left |= level[i] & BIT(KEY);
+    }
+
+    // Final pass handles the lock.
+    if (keys_left) {
+        for (int i = 0; i < LEVEL_SIZE * LEVEL_SIZE; ++i) {
+            updated_level[i] |= level[i] & BIT(LOCK);
+        }
+    }
+
+    // Overwrite the original level with the update.
+    memcpy(level, updated_level, sizeof(Level));
+
+    if (game->delta_log) record_step(game->delta_log, original_level, level);
+
+    // The update is fully carried out, even when it is known earlier on that
+    // the player has done something to end the game, to make sure the player
+    // sees the final state of the game represented on screen at the end.
+    return game_over;
+}
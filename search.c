@@ -0,0 +1,170 @@
+/*
+    search.c
+    Finds a level that passes a test, trying many seeds at once on every processor.
+
+    Often any level will do as long as it passes some test, such as being
+    completable with a walk of at least 50 steps. Rather than running the
+    generator again and again on one thread until one passes, each thread
+    takes the next attempt number, generates a level from the seed for that
+    attempt, and tests it. The time taken is about the number of attempts
+    needed divided by the number of processors.
+
+    When an attempt passes, attempts after it are no longer started, and
+    generators that check search_attempt_cancelled between their stages give
+    up part way. Attempts before it carry on, and the lowest attempt number
+    that passes is the one given back, so the same search always finds the
+    same level, however many threads there are and however they are timed.
+
+    Build with `cc -O2 search.c -o search -pthread -lm`.
+    Run with `./search [min_path] [threads] [seed] > found.lvl` to find a
+    completable level with a walk of at least min_path steps.
+*/
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "common.c"
+
+#define SEARCH_NOT_FOUND -1
+
+// Generates a level from the random number generator, which is seeded for
+// the attempt. Returns false if it gave up because the attempt was cancelled.
+typedef bool (*Search_Generator)(Level level, void * data);
+// Returns true if the level is good enough.
+typedef bool (*Search_Test)(Level level, void * data);
+
+typedef struct {
+    Search_Generator generate;
+    void * generate_data;
+    Search_Test test;
+    void * test_data;
+    u64 seed;
+    // Attempts after this many are not made. 0 for no limit.
+    s64 max_attempts;
+    int thread_count;
+
+    _Atomic s64 next_attempt;
+    // Lowest attempt found to pass so far.
+    _Atomic s64 found;
+    _Atomic s64 attempts_made, attempts_cancelled;
+    pthread_mutex_t lock;
+    Level level;
+} Level_Search;
+
+// The search and attempt that this thread is working on, if any.
+_Thread_local Level_Search * current_search;
+_Thread_local s64 current_attempt;
+
+// Generators can call this between stages, and stop if it returns true,
+// as an earlier attempt has already passed and this one cannot be used.
+bool search_attempt_cancelled(void) {
+    return current_search && current_attempt > atomic_load_explicit(&current_search->found, memory_order_relaxed);
+}
+
+void * search_thread(void * data) {
+    Level_Search * search = data;
+    current_search = search;
+    Level level;
+    while (true) {
+        s64 attempt = atomic_fetch_add(&search->next_attempt, 1);
+        if (search->max_attempts > 0 && attempt >= search->max_attempts) break;
+        if (attempt > atomic_load(&search->found)) break;
+
+        current_attempt = attempt;
+        reset_seed(search->seed, attempt);
+        atomic_fetch_add(&search->attempts_made, 1);
+        bool generated = search->generate(level, search->generate_data);
+        if (!generated || search_attempt_cancelled()) {
+            atomic_fetch_add(&search->attempts_cancelled, 1);
+            continue;
+        }
+        if (!search->test(level, search->test_data)) continue;
+
+        // Keep it if no earlier attempt has passed.
+        pthread_mutex_lock(&search->lock);
+        if (attempt < atomic_load(&search->found)) {
+            memcpy(search->level, level, sizeof(Level));
+            atomic_store(&search->found, attempt);
+        }
+        pthread_mutex_unlock(&search->lock);
+    }
+    current_search = NULL;
+    return NULL;
+}
+
+// Runs the search, putting the level found in 'level'.
+// Returns the attempt number of the level, or SEARCH_NOT_FOUND if none of
+// the attempts passed before max_attempts was reached.
+s64 search_level(Level_Search * search, Level level) {
+    atomic_init(&search->next_attempt, 0);
+    atomic_init(&search->found, INT64_MAX);
+    atomic_init(&search->attempts_made, 0);
+    atomic_init(&search->attempts_cancelled, 0);
+    pthread_mutex_init(&search->lock, NULL);
+
+    int thread_count = MAX(1, search->thread_count);
+    pthread_t threads[thread_count];
+    int started = 0;
+    for (int i = 1; i < thread_count; ++i) {
+        if (pthread_create(&threads[started], NULL, search_thread, search) == 0) ++started;
+    }
+    // This thread helps too, so the search runs even if no threads could be started.
+    search_thread(search);
+    for (int i = 0; i < started; ++i) pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&search->lock);
+
+    s64 found = atomic_load(&search->found);
+    if (found == INT64_MAX) return SEARCH_NOT_FOUND;
+    memcpy(level, search->level, sizeof(Level));
+    return found;
+}
+
+#ifndef NO_MAIN
+
+#include <unistd.h>
+#define NO_MAIN
+#include "level.c"
+#include "metrics.c"
+
+bool dig_and_place(Level level, void * data) {
+    fill_level(level, WALL);
+    digger_generator(level, NULL);
+    if (search_attempt_cancelled()) return false;
+    chokepoint_placer(level, NULL, 1);
+    return true;
+}
+
+bool has_long_walk(Level level, void * data) {
+    int min_path = *(int *)data;
+    int px, py;
+    if (!find_player(level, &px, &py)) return false;
+    u16 distance[LEVEL_SIZE * LEVEL_SIZE];
+    int length = walk_length(level, px + py * LEVEL_SIZE, distance);
+    return length != NO_PATH && length >= min_path;
+}
+
+int main(int argument_count, char ** arguments) {
+    int min_path = argument_count > 1 ? atoi(arguments[1]) : 120;
+    Level_Search search = {
+        .generate = dig_and_place,
+        .test = has_long_walk,
+        .test_data = &min_path,
+        .thread_count = argument_count > 2 ? atoi(arguments[2]) : sysconf(_SC_NPROCESSORS_ONLN),
+        .seed = argument_count > 3 ? strtoull(arguments[3], NULL, 10) : 1,
+        .max_attempts = 1000000,
+    };
+
+    double start = seconds_now();
+    Level level;
+    s64 found = search_level(&search, level);
+    double seconds = seconds_now() - start;
+    if (found == SEARCH_NOT_FOUND) {
+        fprintf(stderr, "No level with a walk of %d steps in %lld attempts.\n", min_path, (long long)search.max_attempts);
+        return 1;
+    }
+    write_level(stdout, level);
+    fprintf(stderr, "Attempt %lld passed, found in %.3f s with %d threads. %lld attempts made, %lld cancelled part way.\n",
+        (long long)found, seconds, search.thread_count, (long long)atomic_load(&search.attempts_made),
+        (long long)atomic_load(&search.attempts_cancelled));
+}
+
+#endif
@@ -0,0 +1,318 @@
+/*
+    segment.c
+    Splits the floor of a level into rooms and corridors.
+
+    Every floor tile is given the number of the region it is in, and regions
+    that touch are joined in a graph, so levels can be scored and annotated by
+    their rooms and the corridors between them.
+
+    Rooms are found from the distance to the nearest wall (see distance.c).
+    Tiles at least ROOM_CORE_DISTANCE from any wall are in the middle of a
+    room, and each joined up patch of them starts a room. The rooms then grow
+    outward from the middle, like water filling basins: each tile reaches out
+    as far as it is from the nearest wall, so a room covers the floor that is
+    in reach of its middle, and stops where the floor narrows. Whatever floor
+    is left over is corridor, and each joined up piece of it is one corridor.
+
+    Every step looks at each tile a fixed number of times, so the whole thing
+    takes time in proportion to the size of the map.
+
+    Build with `cc -O2 segment.c -o segment -lm`.
+    Run with `./segment < in.lvl` to print the rooms and corridors of a level.
+*/
+
+#include "distance.c"
+
+// Tiles at least this far from every wall are in the middle of a room.
+// Floor one or two tiles wide is never more than 1 from a wall.
+#define ROOM_CORE_DISTANCE 2.0f
+
+#define NO_REGION -1
+
+typedef struct {
+    bool is_room;
+    int tile_count;
+    // The first tile of the region, reading along the rows.
+    int x, y;
+} Region;
+
+typedef struct {
+    int width, height;
+    // Region of each tile, one row after another, or NO_REGION if it is not floor.
+    int * tile_regions;
+    // Rooms come first, then corridors.
+    Region * regions;
+    int region_count, room_count;
+    // The regions that touch region r are adjacent[adjacent_start[r]]
+    // up to adjacent[adjacent_start[r + 1]], each one once.
+    int * adjacent_start;
+    int * adjacent;
+} Segmentation;
+
+void free_segmentation(Segmentation * segmentation) {
+    free(segmentation->tile_regions);
+    free(segmentation->regions);
+    free(segmentation->adjacent_start);
+    free(segmentation->adjacent);
+    *segmentation = (Segmentation){0};
+}
+
+bool is_floor_tile(Tile tile) {
+    return (tile & BIT(FLOOR)) && !(tile & BIT(WALL));
+}
+
+// Gives the region 'region' to every unlabelled tile joined to 'start' by a
+// four-way path of tiles for which 'in_region' says yes. 'queue' must have
+// room for every tile. Returns the number of tiles given the region.
+typedef bool (*Region_Test)(Map * map, int x, int y, float * distance);
+int label_region(Map * map, float * distance, int * labels, int * queue, int start, int region, Region_Test in_region) {
+    int width = map->width;
+    int head = 0, tail = 0;
+    labels[start] = region;
+    queue[tail++] = start;
+    while (head < tail) {
+        int tile = queue[head++];
+        int x = tile % width, y = tile / width;
+        int neighbours[4][2] = { {x, y-1}, {x, y+1}, {x-1, y}, {x+1, y} };
+        for (int n = 0; n < 4; ++n) {
+            int nx = neighbours[n][0], ny = neighbours[n][1];
+            if (nx < 0 || ny < 0 || nx >= width || ny >= map->height) continue;
+            int next = nx + ny * width;
+            if (labels[next] != NO_REGION || !in_region(map, nx, ny, distance)) continue;
+            labels[next] = region;
+            queue[tail++] = next;
+        }
+    }
+    return tail;
+}
+
+bool is_room_core(Map * map, int x, int y, float * distance) {
+    return distance[x + y * map->width] >= ROOM_CORE_DISTANCE;
+}
+
+bool is_floor_at(Map * map, int x, int y, float * distance) {
+    return is_floor_tile(*map_tile(map, x, y));
+}
+
+// Lets each room tile reach out to the tiles around it, one step (in any of
+// eight directions) less far than it is from the nearest wall. Tiles with
+// the furthest reach left go first, so the tiles nearest the middle of a
+// room claim the tiles around them. Reach is always a whole number of steps,
+// which is under the largest distance, so it can be kept in buckets rather
+// than a heap and every tile is handled at most once.
+void grow_rooms(Map * map, float * distance, int * labels, int * queue) {
+    int width = map->width, height = map->height;
+    int tile_count = width * height;
+
+    int most_reach = 0;
+    for (int i = 0; i < tile_count; ++i) {
+        if (labels[i] != NO_REGION) most_reach = MAX(most_reach, (int)distance[i] - 1);
+    }
+    // Each bucket is a list of tiles threaded through 'queue'.
+    int * buckets = malloc(sizeof(int) * (most_reach + 1));
+    for (int r = 0; r <= most_reach; ++r) buckets[r] = -1;
+    for (int i = 0; i < tile_count; ++i) {
+        if (labels[i] == NO_REGION) continue;
+        int reach = (int)distance[i] - 1;
+        queue[i] = buckets[reach];
+        buckets[reach] = i;
+    }
+
+    for (int reach = most_reach; reach > 0; --reach) {
+        while (buckets[reach] >= 0) {
+            int tile = buckets[reach];
+            buckets[reach] = queue[tile];
+            int x = tile % width, y = tile / width;
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    int nx = x + dx, ny = y + dy;
+                    if (nx < 0 || ny < 0 || nx >= width || ny >= height) continue;
+                    int next = nx + ny * width;
+                    if (labels[next] != NO_REGION || !is_floor_tile(*map_tile(map, nx, ny))) continue;
+                    labels[next] = labels[tile];
+                    queue[next] = buckets[reach - 1];
+                    buckets[reach - 1] = next;
+                }
+            }
+        }
+    }
+    free(buckets);
+}
+
+// Adds an edge between every two regions with tiles next to each other.
+// Returns false if there was not enough memory.
+bool find_adjacent_regions(Segmentation * segmentation) {
+    int width = segmentation->width, height = segmentation->height;
+    int * labels = segmentation->tile_regions;
+    int region_count = segmentation->region_count;
+    int * start = calloc(region_count + 1, sizeof(int));
+    int * last_seen = malloc(sizeof(int) * MAX(1, region_count));
+    if (!start || !last_seen) {
+        free(start);
+        free(last_seen);
+        return false;
+    }
+
+    // Count the pairs of touching tiles for each region, then put them in
+    // place, then take out the repeats. Like a counting sort, no sorting is needed.
+    #define FOR_EACH_TOUCHING_PAIR(code) \
+        for (int y = 0; y < height; ++y) { \
+            for (int x = 0; x < width; ++x) { \
+                int a = labels[x + y * width]; \
+                if (a == NO_REGION) continue; \
+                int b; \
+                if (x + 1 < width  && (b = labels[x + 1 + y * width])   != NO_REGION && b != a) { code } \
+                if (y + 1 < height && (b = labels[x + (y + 1) * width]) != NO_REGION && b != a) { code } \
+            } \
+        }
+    FOR_EACH_TOUCHING_PAIR(++start[a + 1]; ++start[b + 1];)
+    for (int r = 0; r < region_count; ++r) start[r + 1] += start[r];
+    int * adjacent = malloc(sizeof(int) * MAX(1, start[region_count]));
+    int * fill = malloc(sizeof(int) * MAX(1, region_count));
+    if (!adjacent || !fill) {
+        free(start);
+        free(last_seen);
+        free(adjacent);
+        free(fill);
+        return false;
+    }
+    memcpy(fill, start, sizeof(int) * region_count);
+    FOR_EACH_TOUCHING_PAIR(adjacent[fill[a]++] = b; adjacent[fill[b]++] = a;)
+    #undef FOR_EACH_TOUCHING_PAIR
+
+    for (int r = 0; r < region_count; ++r) last_seen[r] = -1;
+    int kept = 0;
+    for (int r = 0; r < region_count; ++r) {
+        int from = start[r], to = start[r + 1];
+        start[r] = kept;
+        for (int i = from; i < to; ++i) {
+            if (last_seen[adjacent[i]] == r) continue;
+            last_seen[adjacent[i]] = r;
+            adjacent[kept++] = adjacent[i];
+        }
+    }
+    start[region_count] = kept;
+
+    free(fill);
+    free(last_seen);
+    segmentation->adjacent_start = start;
+    segmentation->adjacent = adjacent;
+    return true;
+}
+
+// Splits the floor of a map into rooms and corridors.
+// Returns false if there was not enough memory.
+bool segment_map(Map * map, Segmentation * segmentation) {
+    *segmentation = (Segmentation){ map->width, map->height };
+    int tile_count = map->width * map->height;
+    float * distance = map_wall_distance(map);
+    int * labels = malloc(sizeof(int) * tile_count);
+    int * queue = malloc(sizeof(int) * tile_count);
+    if (!distance || !labels || !queue) {
+        free(labels);
+        free(queue);
+        return false;
+    }
+    segmentation->tile_regions = labels;
+    for (int i = 0; i < tile_count; ++i) labels[i] = NO_REGION;
+
+    // Each joined up patch of room middles is a room.
+    int region_count = 0;
+    for (int i = 0; i < tile_count; ++i) {
+        int x = i % map->width, y = i / map->width;
+        if (labels[i] != NO_REGION || !is_room_core(map, x, y, distance)) continue;
+        label_region(map, distance, labels, queue, i, region_count++, is_room_core);
+    }
+    segmentation->room_count = region_count;
+    grow_rooms(map, distance, labels, queue);
+
+    // The rest of the floor is corridors.
+    for (int i = 0; i < tile_count; ++i) {
+        int x = i % map->width, y = i / map->width;
+        if (labels[i] != NO_REGION || !is_floor_at(map, x, y, distance)) continue;
+        label_region(map, distance, labels, queue, i, region_count++, is_floor_at);
+    }
+    segmentation->region_count = region_count;
+    free(queue);
+
+    segmentation->regions = calloc(MAX(1, region_count), sizeof(Region));
+    if (!segmentation->regions) {
+        free_segmentation(segmentation);
+        return false;
+    }
+    for (int i = tile_count - 1; i >= 0; --i) {
+        if (labels[i] == NO_REGION) continue;
+        Region * region = &segmentation->regions[labels[i]];
+        region->is_room = labels[i] < segmentation->room_count;
+        ++region->tile_count;
+        region->x = i % map->width;
+        region->y = i / map->width;
+    }
+
+    if (!find_adjacent_regions(segmentation)) {
+        free_segmentation(segmentation);
+        return false;
+    }
+    return true;
+}
+
+bool segment_level(Level level, Segmentation * segmentation) {
+    Map map = level_as_map(level);
+    bool ok = segment_map(&map, segmentation);
+    forget_wall_distance(&map);
+    return ok;
+}
+
+#ifndef NO_MAIN
+
+#define NO_MAIN
+#include "stream.c"
+
+int main(int argument_count, char ** arguments) {
+    Map map;
+    if (!load_map(stdin, &map)) {
+        fprintf(stderr, "Could not read the map.\n");
+        return 1;
+    }
+
+    double start = seconds_now();
+    Segmentation segmentation;
+    if (!segment_map(&map, &segmentation)) {
+        fprintf(stderr, "Not enough memory.\n");
+        return 1;
+    }
+    double seconds = seconds_now() - start;
+    printf("%d rooms and %d corridors in %.3f s (%.1f million tiles per second)\n",
+        segmentation.room_count, segmentation.region_count - segmentation.room_count,
+        seconds, (double)map.width * map.height / seconds / 1e6);
+
+    // Small maps are drawn, with rooms as letters and corridors as digits.
+    if (map.width <= 80 && map.height <= 80) {
+        for (int y = 0; y < map.height; ++y) {
+            for (int x = 0; x < map.width; ++x) {
+                int region = segmentation.tile_regions[x + y * map.width];
+                int corridor = region - segmentation.room_count;
+                if (region == NO_REGION) putchar('#');
+                else if (region < segmentation.room_count) putchar('A' + region % 26);
+                else putchar('0' + corridor % 10);
+            }
+            putchar('\n');
+        }
+        for (int r = 0; r < segmentation.region_count; ++r) {
+            Region * region = &segmentation.regions[r];
+            printf("%s %d: %d tiles, joined to", region->is_room ? "room" : "corridor",
+                region->is_room ? r : r - segmentation.room_count, region->tile_count);
+            for (int i = segmentation.adjacent_start[r]; i < segmentation.adjacent_start[r + 1]; ++i) {
+                int other = segmentation.adjacent[i];
+                if (other < segmentation.room_count) printf(" room %d", other);
+                else printf(" corridor %d", other - segmentation.room_count);
+            }
+            printf("\n");
+        }
+    }
+
+    free_segmentation(&segmentation);
+    free_map(&map);
+}
+
+#endif
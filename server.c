@@ -0,0 +1,350 @@
+/*
+    server.c
+    Runs many games at once in one process, with no window, taking each player's steps as they come in.
+
+    Each session has its own level, its own stats (see rules.c) and its own
+    random number generator state, so nothing is shared between games. The
+    generator is thread local, so a thread running a session swaps in the
+    session's state first and saves it after. A game therefore plays out the
+    same for the same steps, whichever thread runs it and whatever else is
+    running.
+
+    Steps come in to each session through a small ring: one side pushes,
+    one side takes, as with telemetry.c. A session with steps waiting is put
+    on a run queue, once however many steps it has, and a pool of threads
+    takes sessions off the queue and runs their steps. Only a few steps are
+    run each time, then the session goes to the back of the queue, so a busy
+    session does not hold up the others. A session is only ever run by one
+    thread at a time, so its game needs no lock.
+
+    When a game ends, the session starts its level again.
+
+    Build with `cc -O2 server.c -o server -pthread -lm`.
+    Run with `./server [sessions] [threads] [seconds] [rate]` to measure the
+    most steps per second the server can take, and then the time from a
+    step being sent to it being run, with steps sent at 'rate' per second
+    (half the most it can take, if not given).
+*/
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "rules.c"
+
+// Steps that can wait in each session. Must be a power of two.
+#define SESSION_INPUTS 64
+// Steps run each time a session is taken off the run queue.
+#define SESSION_BATCH 8
+// Latencies are counted in buckets, 4 for each doubling of nanoseconds.
+#define LATENCY_BUCKETS 160
+
+typedef struct {
+    u8 direction;
+    // When the step was sent, from seconds_now.
+    double time;
+} Session_Input;
+
+typedef struct {
+    Level level;
+    // The level as it was at the start, to go back to when a game ends.
+    Tile * start;
+    Game game;
+    u64 random_seed[2];
+    int games_finished;
+
+    Session_Input inputs[SESSION_INPUTS];
+    // Total steps ever pushed, and ever taken.
+    _Atomic u32 head, tail;
+    // Set while the session is on the run queue or being run.
+    atomic_bool scheduled;
+} Game_Session;
+
+typedef struct {
+    Game_Session * sessions;
+    int session_count;
+
+    // Sessions waiting to be run. Each is on it at most once, so it never
+    // holds more than session_count.
+    int * queue;
+    int queue_head, queue_count;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    bool stopping;
+
+    pthread_t * threads;
+    int thread_count;
+
+    atomic_llong steps_run, steps_dropped;
+    _Atomic u64 latencies[LATENCY_BUCKETS];
+} Session_Server;
+
+// Starts a session on a level, which is not copied and must outlive it.
+// The session's random number generator is seeded from 'seed' and 'id'.
+void start_session(Game_Session * session, Tile * level, u64 seed, u64 id) {
+    session->start = level;
+    memcpy(session->level, level, sizeof(Level));
+    session->game = (Game){0};
+    session->games_finished = 0;
+    atomic_init(&session->head, 0);
+    atomic_init(&session->tail, 0);
+    atomic_init(&session->scheduled, false);
+
+    u64 saved[2] = { random_seed[0], random_seed[1] };
+    reset_seed(seed, id);
+    session->random_seed[0] = random_seed[0];
+    session->random_seed[1] = random_seed[1];
+    random_seed[0] = saved[0];
+    random_seed[1] = saved[1];
+}
+
+// Whether a step sent now would be dropped.
+bool session_is_full(Game_Session * session) {
+    return atomic_load(&session->head) - atomic_load(&session->tail) == SESSION_INPUTS;
+}
+
+// Called by one sender for each session.
+// Returns false if the step was dropped because too many are waiting.
+bool push_session_input(Game_Session * session, int direction, double time) {
+    u32 head = atomic_load_explicit(&session->head, memory_order_relaxed);
+    u32 tail = atomic_load_explicit(&session->tail, memory_order_acquire);
+    if (head - tail == SESSION_INPUTS) return false;
+    session->inputs[head & (SESSION_INPUTS - 1)] = (Session_Input){ direction, time };
+    atomic_store_explicit(&session->head, head + 1, memory_order_release);
+    return true;
+}
+
+void count_latency(Session_Server * server, double seconds) {
+    double nanoseconds = MAX(1.0, seconds * 1e9);
+    int bucket = CLAMP(0, (int)(4 * log2(nanoseconds)), LATENCY_BUCKETS - 1);
+    atomic_fetch_add_explicit(&server->latencies[bucket], 1, memory_order_relaxed);
+}
+
+// Runs up to SESSION_BATCH of the steps waiting in a session.
+// Returns the number run.
+int run_session(Session_Server * server, Game_Session * session) {
+    u32 head = atomic_load_explicit(&session->head, memory_order_acquire);
+    u32 tail = atomic_load_explicit(&session->tail, memory_order_relaxed);
+    int count = MIN(head - tail, SESSION_BATCH);
+    if (count == 0) return 0;
+
+    u64 saved[2] = { random_seed[0], random_seed[1] };
+    random_seed[0] = session->random_seed[0];
+    random_seed[1] = session->random_seed[1];
+    for (int i = 0; i < count; ++i) {
+        Session_Input input = session->inputs[(tail + i) & (SESSION_INPUTS - 1)];
+        bool game_over = update_level(session->level, input.direction, &session->game);
+        ++session->game.steps_taken;
+        if (game_over) {
+            ++session->games_finished;
+            memcpy(session->level, session->start, sizeof(Level));
+        }
+        count_latency(server, seconds_now() - input.time);
+    }
+    session->random_seed[0] = random_seed[0];
+    session->random_seed[1] = random_seed[1];
+    random_seed[0] = saved[0];
+    random_seed[1] = saved[1];
+
+    atomic_store_explicit(&session->tail, tail + count, memory_order_release);
+    atomic_fetch_add_explicit(&server->steps_run, count, memory_order_relaxed);
+    return count;
+}
+
+// Puts a session on the run queue, unless it is already on it or being run.
+void schedule_session(Session_Server * server, int index) {
+    if (atomic_exchange(&server->sessions[index].scheduled, true)) return;
+    pthread_mutex_lock(&server->lock);
+    server->queue[(server->queue_head + server->queue_count) % server->session_count] = index;
+    ++server->queue_count;
+    pthread_cond_signal(&server->ready);
+    pthread_mutex_unlock(&server->lock);
+}
+
+void * session_thread(void * data) {
+    Session_Server * server = data;
+    while (true) {
+        pthread_mutex_lock(&server->lock);
+        while (server->queue_count == 0 && !server->stopping) {
+            pthread_cond_wait(&server->ready, &server->lock);
+        }
+        if (server->queue_count == 0) {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+        int index = server->queue[server->queue_head];
+        server->queue_head = (server->queue_head + 1) % server->session_count;
+        --server->queue_count;
+        pthread_mutex_unlock(&server->lock);
+
+        Game_Session * session = &server->sessions[index];
+        run_session(server, session);
+        // Let it be put on the queue again, then check for steps that came
+        // in while it was running, as their sender will have seen it still
+        // scheduled and not put it on.
+        atomic_store(&session->scheduled, false);
+        if (atomic_load(&session->head) != atomic_load(&session->tail)) schedule_session(server, index);
+    }
+    return NULL;
+}
+
+// Sends a step to a session. Returns false if it was dropped.
+bool send_step(Session_Server * server, int index, int direction) {
+    if (!push_session_input(&server->sessions[index], direction, seconds_now())) {
+        atomic_fetch_add_explicit(&server->steps_dropped, 1, memory_order_relaxed);
+        return false;
+    }
+    schedule_session(server, index);
+    return true;
+}
+
+// Starts the threads. The sessions must already be started.
+// Returns false if no thread could be started.
+bool start_server(Session_Server * server, Game_Session * sessions, int session_count, int thread_count) {
+    *server = (Session_Server){ sessions, session_count };
+    server->queue = malloc(sizeof(int) * MAX(1, session_count));
+    server->threads = malloc(sizeof(pthread_t) * MAX(1, thread_count));
+    if (!server->queue || !server->threads) {
+        free(server->queue);
+        free(server->threads);
+        return false;
+    }
+    atomic_init(&server->steps_run, 0);
+    atomic_init(&server->steps_dropped, 0);
+    for (int b = 0; b < LATENCY_BUCKETS; ++b) atomic_init(&server->latencies[b], 0);
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->ready, NULL);
+    for (int i = 0; i < thread_count; ++i) {
+        if (pthread_create(&server->threads[server->thread_count], NULL, session_thread, server) == 0) {
+            ++server->thread_count;
+        }
+    }
+    return server->thread_count > 0;
+}
+
+// Runs every step already sent, then stops the threads.
+void stop_server(Session_Server * server) {
+    pthread_mutex_lock(&server->lock);
+    server->stopping = true;
+    pthread_cond_broadcast(&server->ready);
+    pthread_mutex_unlock(&server->lock);
+    for (int i = 0; i < server->thread_count; ++i) pthread_join(server->threads[i], NULL);
+    pthread_mutex_destroy(&server->lock);
+    pthread_cond_destroy(&server->ready);
+    free(server->queue);
+    free(server->threads);
+}
+
+// The latency that 'fraction' of steps were run within, in seconds.
+// Accurate to within a fifth or so, the width of a bucket.
+double latency_percentile(Session_Server * server, double fraction) {
+    u64 total = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; ++b) total += atomic_load(&server->latencies[b]);
+    u64 wanted = ceil(total * fraction), seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; ++b) {
+        seen += atomic_load(&server->latencies[b]);
+        if (seen >= wanted && seen > 0) return exp2((b + 1) / 4.0) / 1e9;
+    }
+    return 0;
+}
+
+#ifndef NO_MAIN
+
+#include <unistd.h>
+#define NO_MAIN
+#include "level.c"
+
+#define LEVEL_POOL 64
+
+typedef struct {
+    Session_Server server;
+    s64 sent;
+    double seconds;
+} Benchmark;
+
+// Sends random steps to random sessions for 'seconds'. With a rate of 0,
+// they are sent as fast as they can be taken, skipping sessions that are
+// full; otherwise 'rate' are sent each second, dropping any that do not fit.
+void run_benchmark(Benchmark * benchmark, Level * levels, Game_Session * sessions,
+        int session_count, int thread_count, double seconds, double rate) {
+    for (int s = 0; s < session_count; ++s) {
+        start_session(&sessions[s], levels[s % LEVEL_POOL], 1, s);
+    }
+    *benchmark = (Benchmark){0};
+    if (!start_server(&benchmark->server, sessions, session_count, thread_count)) {
+        fprintf(stderr, "Could not start any threads.\n");
+        exit(1);
+    }
+
+    double start = seconds_now(), now = start;
+    while (now - start < seconds) {
+        s64 due = rate > 0 ? (s64)((now - start) * rate) : benchmark->sent + 1024;
+        while (benchmark->sent < due) {
+            int index = random_int_range(0, session_count - 1);
+            int direction = random_int_range(UP, RIGHT);
+            // Give the threads a turn, rather than looking for a session
+            // with room while they are the ones holding the steps up.
+            if (rate == 0 && session_is_full(&sessions[index])) break;
+            send_step(&benchmark->server, index, direction);
+            ++benchmark->sent;
+        }
+        if (rate > 0) usleep(100);
+        else sched_yield();
+        now = seconds_now();
+    }
+    stop_server(&benchmark->server);
+    benchmark->seconds = seconds_now() - start;
+}
+
+void print_benchmark(char * name, Benchmark * benchmark) {
+    Session_Server * server = &benchmark->server;
+    s64 run = atomic_load(&server->steps_run);
+    printf("%s: %lld steps run in %.3f s (%.0f per second), %lld dropped.\n", name,
+        (long long)run, benchmark->seconds, run / benchmark->seconds,
+        (long long)atomic_load(&server->steps_dropped));
+    printf("    Latency: p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us.\n",
+        latency_percentile(server, 0.5) * 1e6, latency_percentile(server, 0.99) * 1e6,
+        latency_percentile(server, 0.999) * 1e6, latency_percentile(server, 1.0) * 1e6);
+}
+
+int main(int argument_count, char ** arguments) {
+    int session_count = argument_count > 1 ? atoi(arguments[1]) : 4096;
+    int thread_count = argument_count > 2 ? atoi(arguments[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+    double seconds = argument_count > 3 ? atof(arguments[3]) : 2.0;
+    double rate = argument_count > 4 ? atof(arguments[4]) : 0;
+    session_count = MAX(1, session_count);
+    thread_count = MAX(1, thread_count);
+
+    // A few levels, shared between the sessions.
+    reset_seed(1, 0);
+    Level * levels = malloc(sizeof(Level) * LEVEL_POOL);
+    Game_Session * sessions = malloc(sizeof(Game_Session) * session_count);
+    if (!levels || !sessions) {
+        fprintf(stderr, "Not enough memory for %d sessions.\n", session_count);
+        return 1;
+    }
+    for (int i = 0; i < LEVEL_POOL; ++i) {
+        fill_level(levels[i], WALL);
+        digger_generator(levels[i], NULL);
+        chokepoint_placer(levels[i], NULL, 1);
+    }
+
+    printf("%d sessions on %d threads.\n", session_count, thread_count);
+    Benchmark most;
+    run_benchmark(&most, levels, sessions, session_count, thread_count, seconds, 0);
+    print_benchmark("As fast as possible", &most);
+
+    if (rate <= 0) rate = atomic_load(&most.server.steps_run) / most.seconds / 2;
+    Benchmark paced;
+    run_benchmark(&paced, levels, sessions, session_count, thread_count, seconds, rate);
+    char name[64];
+    snprintf(name, sizeof(name), "At %.0f steps per second", rate);
+    print_benchmark(name, &paced);
+
+    int finished = 0;
+    for (int s = 0; s < session_count; ++s) finished += sessions[s].games_finished;
+    printf("%d games finished in the second run.\n", finished);
+
+    free(sessions);
+    free(levels);
+}
+
+#endif
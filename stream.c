@@ -0,0 +1,443 @@
+/*
+    stream.c
+    Generates maps one row at a time, for maps too tall to hold in memory.
+
+    Rows are handed to a Row_Func as soon as they are made, and only the
+    current row is kept. A map of any height can be written straight to a file
+    using the Row_Writer.
+
+    Rows can also be passed through a chain of Row_Stages on the way, each of
+    which only sees a small window of rows around the one it is working on.
+    The whole pipeline holds a few rows, however tall the map is.
+
+    Build with `cc stream.c -o stream`.
+    Run with `./stream width height > out.map`.
+    A 22 by 22 map is written as a plain '.lvl' file.
+    Run with `./stream width height out.mapb` to write into a memory-mapped
+    map file instead, for maps too big to hold in memory (see mapfile.c).
+*/
+
+#include "common.c"
+#include "mapfile.c"
+
+// Called with each row of a map in turn. Return true to stop early.
+typedef bool (*Row_Func)(Tile * row, int y, void * data);
+
+// Files of any size start with this header, and then hold the rows in order.
+// Maps that are the size of a level are written without it, so they can be
+// read back as a level.
+#define MAP_MAGIC 0x3150414d
+
+typedef struct {
+    FILE * file;
+    int width, height;
+    int rows_written;
+    bool has_header;
+} Row_Writer;
+
+// Starts writing a map. If the height is not known yet, pass 0, and it will
+// be filled in when the writer is ended, if the file can be seeked.
+bool begin_row_writer(Row_Writer * writer, FILE * file, int width, int height) {
+    *writer = (Row_Writer){ file, width, height, 0, true };
+    if (width == LEVEL_SIZE && height == LEVEL_SIZE) {
+        writer->has_header = false;
+        return true;
+    }
+    u32 header[3] = { MAP_MAGIC, width, height };
+    return fwrite(header, sizeof(header), 1, file);
+}
+
+// A Row_Func that writes rows out. Pass the Row_Writer in as data.
+// Stops the stream if the file cannot be written.
+bool write_row(Tile * row, int y, void * data) {
+    Row_Writer * writer = data;
+    if (fwrite(row, sizeof(Tile), writer->width, writer->file) != (size_t)writer->width) return true;
+    ++writer->rows_written;
+    return false;
+}
+
+bool end_row_writer(Row_Writer * writer) {
+    if (writer->has_header && writer->height != writer->rows_written) {
+        // Go back and fill in the real height.
+        u32 height = writer->rows_written;
+        if (fseek(writer->file, sizeof(u32) * 2, SEEK_SET) != 0) return false;
+        if (!fwrite(&height, sizeof(u32), 1, writer->file)) return false;
+        fseek(writer->file, 0, SEEK_END);
+    }
+    return fflush(writer->file) == 0;
+}
+
+// A Row_Func that writes rows into a map file. Pass the Map_File in as data.
+// Each row of blocks is released once it has been filled.
+bool write_map_file_row(Tile * row, int y, void * data) {
+    Map_File * map_file = data;
+    Map * map = &map_file->map;
+    if (y >= map->height) return true;
+    for (int x = 0; x < map->width; ++x) *map_tile(map, x, y) = row[x];
+    int block_size = 1 << map->block_shift;
+    if ((y + 1) % block_size == 0) release_map_area(map_file, 0, y - block_size + 1, map->width - 1, y);
+    return false;
+}
+
+// Reads a whole map written by a Row_Writer, for maps small enough to fit.
+// Files with no header are read as plain '.lvl' files, as the writer makes.
+bool load_map(FILE * file, Map * map) {
+    u32 header[3];
+    if (!fread(header, sizeof(u32), 1, file)) return false;
+    if (header[0] != MAP_MAGIC) {
+        // The first two tiles of the level were just read as the magic number.
+        *map = make_map(LEVEL_SIZE, LEVEL_SIZE);
+        if (!map->tiles) return false;
+        memcpy(map->tiles, header, sizeof(u32));
+        size_t rest = LEVEL_SIZE * LEVEL_SIZE - sizeof(u32) / sizeof(Tile);
+        return fread(map->tiles + sizeof(u32) / sizeof(Tile), sizeof(Tile), rest, file) == rest;
+    }
+    if (!fread(header + 1, sizeof(u32), 2, file)) return false;
+    *map = make_map(header[1], header[2]);
+    if (!map->tiles) return false;
+    size_t count = (size_t)map->width * map->height;
+    return fread(map->tiles, sizeof(Tile), count, file) == count;
+}
+
+// Eller's algorithm: a perfect maze built a row at a time, where only the set
+// each cell of the current row belongs to is remembered. Cells sit on odd tiles,
+// and the walls between them are opened to join their sets. Every set carries
+// on into the next row through at least one opening, and the last row joins
+// all remaining sets, so every floor tile can be reached from every other.
+// A height of 0 or less keeps going until 'func' asks to stop; any region is
+// then still guaranteed to reach the bottom edge of what was made.
+// Only memory proportional to the width is used.
+void eller_generator(int width, int height, Row_Func func, void * data) {
+    int cells = (width - 1) / 2;
+    int cell_rows = height > 0 ? (height - 1) / 2 : INT_MAX;
+    if (cells < 1 || cell_rows < 1) return;
+
+    Tile * row = malloc(sizeof(Tile) * width);
+    int * label = malloc(sizeof(int) * cells);
+    int * parent = malloc(sizeof(int) * cells);
+    int * last = malloc(sizeof(int) * cells);
+    int * remap = malloc(sizeof(int) * cells);
+    bool * carried = malloc(sizeof(bool) * cells);
+    bool * opened = malloc(sizeof(bool) * cells);
+
+    for (int c = 0; c < cells; ++c) label[c] = c;
+
+    int y = 0;
+    for (int x = 0; x < width; ++x) row[x] = BIT(WALL);
+    bool stop = func(row, y++, data);
+
+    for (int r = 0; r < cell_rows && !stop; ++r) {
+        bool last_row = (r == cell_rows - 1);
+
+        // Labels are always below 'cells', so they index the union-find directly.
+        for (int c = 0; c < cells; ++c) parent[c] = c;
+        #define FIND(start, out) do { \
+            int f = (start); \
+            while (parent[f] != f) f = parent[f] = parent[parent[f]]; \
+            out = f; \
+        } while (0)
+
+        // Join neighbouring cells that are in different sets at random.
+        // On the last row, join all of them.
+        for (int x = 0; x < width; ++x) row[x] = BIT(WALL);
+        for (int c = 0; c < cells; ++c) {
+            row[c * 2 + 1] = BIT(FLOOR);
+            if (c == cells - 1) continue;
+            int a, b;
+            FIND(label[c], a);
+            FIND(label[c + 1], b);
+            if (a != b && (last_row || chance(0.5f))) {
+                parent[b] = a;
+                row[c * 2 + 2] = BIT(FLOOR);
+            }
+        }
+        stop = func(row, y++, data);
+        if (stop || last_row) break;
+
+        // Each set opens downward at random, but always at least once.
+        for (int c = 0; c < cells; ++c) {
+            FIND(label[c], label[c]);
+            last[label[c]] = c;
+            remap[c] = -1;
+        }
+        for (int c = 0; c < cells; ++c) carried[label[c]] = false;
+        for (int x = 0; x < width; ++x) row[x] = BIT(WALL);
+        for (int c = 0; c < cells; ++c) {
+            int set = label[c];
+            bool open = chance(0.5f) || (last[set] == c && !carried[set]);
+            if (open) {
+                carried[set] = true;
+                row[c * 2 + 1] = BIT(FLOOR);
+            }
+            opened[c] = open;
+        }
+        #undef FIND
+        stop = func(row, y++, data);
+
+        // Cells below an opening keep their set, the rest start new ones.
+        // Renumber so that labels stay below 'cells'.
+        int next = 0;
+        for (int c = 0; c < cells; ++c) {
+            if (opened[c]) {
+                if (remap[label[c]] < 0) remap[label[c]] = next++;
+                label[c] = remap[label[c]];
+            } else {
+                label[c] = -1;
+            }
+        }
+        for (int c = 0; c < cells; ++c) {
+            if (label[c] < 0) label[c] = next++;
+        }
+    }
+
+    // Close off the bottom, including any extra row left by an even height.
+    for (int x = 0; x < width; ++x) row[x] = BIT(WALL);
+    while (!stop && height > 0 && y < height) stop = func(row, y++, data);
+
+    free(row);
+    free(label);
+    free(parent);
+    free(last);
+    free(remap);
+    free(carried);
+    free(opened);
+}
+
+// A stage of a row pipeline. It is called for each row once 'radius' rows
+// below it have arrived. rows[radius] is the row to work on, the rows above it
+// have already been through this stage, and the rows below it have not.
+// Rows past the top or bottom of the map are NULL.
+typedef void (*Row_Stage_Func)(Tile ** rows, int width, int y, void * data);
+
+typedef struct Row_Stage Row_Stage;
+struct Row_Stage {
+    Row_Stage_Func func;
+    int radius;
+    void * data;
+    int width;
+    // The last 2 * radius + 1 rows to arrive.
+    Tile * ring;
+    int rows_in, rows_out;
+    // Finished rows go on to the next stage, or to 'sink' if this is the last.
+    Row_Stage * next;
+    Row_Func sink;
+    void * sink_data;
+    bool stopped;
+};
+
+void begin_row_stage(Row_Stage * stage, Row_Stage_Func func, int radius, void * data, int width) {
+    *stage = (Row_Stage){0};
+    stage->func = func;
+    stage->radius = radius;
+    stage->data = data;
+    stage->width = width;
+    stage->ring = malloc(sizeof(Tile) * width * (radius * 2 + 1));
+}
+
+// Joins stages together in the given order, ending at 'sink'.
+void chain_row_stages(Row_Stage ** stages, int count, Row_Func sink, void * sink_data) {
+    for (int i = 0; i < count; ++i) {
+        stages[i]->next = i + 1 < count ? stages[i + 1] : NULL;
+        stages[i]->sink = sink;
+        stages[i]->sink_data = sink_data;
+    }
+}
+
+Tile * ring_row(Row_Stage * stage, int y) {
+    return &stage->ring[(y % (stage->radius * 2 + 1)) * stage->width];
+}
+
+bool push_row(Tile * row, int y, void * data);
+
+// Runs the stage on its oldest waiting row, and passes it on.
+bool process_row(Row_Stage * stage) {
+    int y = stage->rows_out++;
+    Tile * rows[stage->radius * 2 + 1];
+    for (int i = -stage->radius; i <= stage->radius; ++i) {
+        bool inside = y + i >= 0 && y + i < stage->rows_in;
+        rows[i + stage->radius] = inside ? ring_row(stage, y + i) : NULL;
+    }
+    stage->func(rows, stage->width, y, stage->data);
+
+    if (stage->next) return push_row(rows[stage->radius], y, stage->next);
+    return stage->sink(rows[stage->radius], y, stage->sink_data);
+}
+
+// A Row_Func that feeds a row into a stage. Pass the first Row_Stage as data.
+bool push_row(Tile * row, int y, void * data) {
+    Row_Stage * stage = data;
+    if (stage->stopped) return true;
+    memcpy(ring_row(stage, stage->rows_in), row, sizeof(Tile) * stage->width);
+    ++stage->rows_in;
+    while (!stage->stopped && stage->rows_out + stage->radius < stage->rows_in) {
+        stage->stopped = process_row(stage);
+    }
+    return stage->stopped;
+}
+
+// Flushes the rows still waiting in each stage at the end of the map,
+// and frees the stages.
+void end_row_stages(Row_Stage * stage) {
+    while (stage) {
+        while (!stage->stopped && stage->rows_out < stage->rows_in) {
+            stage->stopped = process_row(stage);
+        }
+        free(stage->ring);
+        stage->ring = NULL;
+        stage = stage->next;
+    }
+}
+
+// Walls off the edges of the map. Needs a radius of 1 to find the last row.
+void border_stage(Tile ** rows, int width, int y, void * data) {
+    Tile * row = rows[1];
+    if (!rows[0] || !rows[2]) {
+        for (int x = 0; x < width; ++x) row[x] = BIT(WALL);
+    }
+    row[0] = BIT(WALL);
+    row[width - 1] = BIT(WALL);
+}
+
+typedef struct {
+    float gold_chance;
+    float enemy_chance;
+} Scatter_Stage;
+
+// Scatters gold and enemies over empty floor.
+void scatter_stage(Tile ** rows, int width, int y, void * data) {
+    Scatter_Stage * scatter = data;
+    Tile * row = rows[0];
+    for (int x = 0; x < width; ++x) {
+        if (row[x] != BIT(FLOOR)) continue;
+        if (chance(scatter->gold_chance))  row[x] |= BIT(GOLD); else
+        if (chance(scatter->enemy_chance)) row[x] |= BIT(ENEMY);
+    }
+}
+
+bool walkable(Tile tile) {
+    return (tile & (BIT(FLOOR) | BIT(WALL) | BIT(SPIKES))) == BIT(FLOOR);
+}
+
+// Scatters spikes over empty floor, but only where there is a way around them,
+// so that the map stays as connected as it was. Needs a radius of 1.
+void spike_stage(Tile ** rows, int width, int y, void * data) {
+    float * spikes_chance = data;
+    Tile * row = rows[1];
+    if (!rows[0] || !rows[2]) return;
+    for (int x = 1; x < width - 1; ++x) {
+        if (row[x] != BIT(FLOOR) || !chance(*spikes_chance)) continue;
+        u8 ring = walkable(rows[0][x])          << 0
+                | walkable(rows[0][x + 1])      << 1
+                | walkable(row[x + 1])          << 2
+                | walkable(rows[2][x + 1])      << 3
+                | walkable(rows[2][x])          << 4
+                | walkable(rows[2][x - 1])      << 5
+                | walkable(row[x - 1])          << 6
+                | walkable(rows[0][x - 1])      << 7;
+        if (!is_local_cut(ring)) row[x] |= BIT(SPIKES);
+    }
+}
+
+typedef struct {
+    // The key and the locked exit go on the first empty floor at or below these rows.
+    int key_row, exit_row;
+    bool placed_player, placed_key, placed_exit;
+    int player_x, player_y;
+} Placement_Stage;
+
+// Places the player near the top, then the key and the exit further down.
+void placement_stage(Tile ** rows, int width, int y, void * data) {
+    Placement_Stage * placement = data;
+    Tile * row = rows[0];
+    for (int x = 0; x < width; ++x) {
+        if (row[x] != BIT(FLOOR)) continue;
+        if (!placement->placed_player) {
+            row[x] |= BIT(PLAYER);
+            placement->placed_player = true;
+            placement->player_x = x;
+            placement->player_y = y;
+        } else if (!placement->placed_key && y >= placement->key_row) {
+            row[x] |= BIT(KEY);
+            placement->placed_key = true;
+        } else if (!placement->placed_exit && y >= placement->exit_row) {
+            row[x] |= BIT(EXIT) | BIT(LOCK);
+            placement->placed_exit = true;
+        }
+    }
+}
+
+#ifndef NO_MAIN
+
+// A Map_Band_Func that counts the tiles with each entity on them, by bit.
+void count_map_band(Map * map, int y0, int y1, void * data) {
+    s64 * counts = data;
+    for (int y = y0; y <= y1; ++y) {
+        for (int x = 0; x < map->width; ++x) {
+            Tile tile = *map_tile(map, x, y);
+            for (int bit = 0; bit < 16; ++bit) counts[bit] += (tile >> bit) & 1;
+        }
+    }
+}
+
+int main(int argument_count, char ** arguments) {
+    int width  = argument_count > 1 ? atoi(arguments[1]) : LEVEL_SIZE;
+    int height = argument_count > 2 ? atoi(arguments[2]) : LEVEL_SIZE;
+    set_seed(1, 1);
+
+    Row_Writer writer;
+    Map_File map_file;
+    char * map_path = argument_count > 3 ? arguments[3] : NULL;
+    if (map_path) {
+        if (!open_map_file(&map_file, map_path, width, height)) {
+            fprintf(stderr, "Could not open %s.\n", map_path);
+            return 1;
+        }
+        // An existing file keeps its own size, but rows are only made 'width' wide.
+        if (map_file.map.width != width || map_file.map.height != height) {
+            fprintf(stderr, "%s is %d by %d, not %d by %d.\n", map_path,
+                map_file.map.width, map_file.map.height, width, height);
+            close_map_file(&map_file);
+            return 1;
+        }
+    } else if (!begin_row_writer(&writer, stdout, width, height)) {
+        return 1;
+    }
+
+    // Generator -> walls -> player, key and exit -> gold and enemies -> spikes -> file.
+    Placement_Stage placement = { height / 2, height - height / 8 - 2 };
+    Scatter_Stage scatter = { 0.07f, 0.03f };
+    float spikes_chance = 0.03f;
+
+    Row_Stage border, place, gold, spikes;
+    begin_row_stage(&border, border_stage,    1, NULL,           width);
+    begin_row_stage(&place,  placement_stage, 0, &placement,     width);
+    begin_row_stage(&gold,   scatter_stage,   0, &scatter,       width);
+    begin_row_stage(&spikes, spike_stage,     1, &spikes_chance, width);
+    Row_Stage * stages[] = { &border, &place, &gold, &spikes };
+    if (map_path) chain_row_stages(stages, 4, write_map_file_row, &map_file);
+    else chain_row_stages(stages, 4, write_row, &writer);
+
+    eller_generator(width, height, push_row, &border);
+    end_row_stages(&border);
+
+    if (map_path) {
+        // Check the result by flooding it from the player, out of core.
+        Tile seen = 0;
+        s64 reached = map_file_flood(&map_file, placement.player_x, placement.player_y,
+            BIT(FLOOR) | BIT(WALL) | BIT(SPIKES), BIT(FLOOR), flood_record_tiles, &seen);
+        fprintf(stderr, "Reached %lld tiles from the player, completable: %d\n",
+            (long long)reached, (seen & (BIT(KEY) | BIT(EXIT))) == (BIT(KEY) | BIT(EXIT)));
+
+        // Count what is on the map a band at a time, holding only a few bands.
+        s64 counts[16] = {0};
+        for_each_map_band(&map_file, 256, count_map_band, counts);
+        fprintf(stderr, "Floor %lld, walls %lld, gold %lld, enemies %lld, spikes %lld.\n",
+            (long long)counts[FLOOR], (long long)counts[WALL], (long long)counts[GOLD],
+            (long long)counts[ENEMY], (long long)counts[SPIKES]);
+        close_map_file(&map_file);
+        return 0;
+    }
+    return !end_row_writer(&writer);
+}
+
+#endif
@@ -0,0 +1,246 @@
+/*
+    symmetry.c
+    Rotations and reflections of levels, for finding repeats and making more levels.
+
+    A level turned or mirrored plays the same as the original, so a corpus of
+    levels should count them as one. Each level has 8 such variants (the 4
+    rotations, each one mirrored or not). One of them is picked as the
+    canonical form, the same one whichever variant you start from, and its
+    hash is the level's hash. The other variants can also be written out, to
+    make a corpus eight times the size.
+
+    The level is turned into bitboards first: one for each tile bit in use,
+    with a 32 bit word for each row. Then mirroring left to right reverses the
+    bits of each word, mirroring top to bottom swaps the order of the words,
+    and swapping rows for columns is done by swapping blocks of bits between
+    words, halving the block size each time: 5 rounds of a few word operations
+    for each row. Every variant is one of those three, or some of them one
+    after another.
+
+    Build with `cc -O2 symmetry.c -o symmetry`.
+    Run with `./symmetry < levels` to count the different levels in a set of
+    levels saved one after another, or `./symmetry variants < levels > more`
+    to write out every different variant of each different level.
+*/
+
+#include "common.c"
+
+#define BOARD_SIZE 32
+#define BOARD_PLANES 16
+#define SYMMETRY_COUNT 8
+
+// The three steps that make up a variant. Swapping rows and columns comes first.
+#define FLIP_X    BIT(0)
+#define FLIP_Y    BIT(1)
+#define TRANSPOSE BIT(2)
+
+typedef struct {
+    // Bit x of rows[b][y] is bit b of the tile at x, y.
+    u32 rows[BOARD_PLANES][BOARD_SIZE];
+    // The tile bits that are set somewhere in the level.
+    u16 planes;
+} Level_Bits;
+
+void level_to_bits(Level level, Level_Bits * bits) {
+    memset(bits, 0, sizeof(Level_Bits));
+    for (int y = 0; y < LEVEL_SIZE; ++y) {
+        for (int x = 0; x < LEVEL_SIZE; ++x) {
+            Tile tile = level[x + y * LEVEL_SIZE];
+            bits->planes |= tile;
+            while (tile) {
+                int b = __builtin_ctz(tile);
+                bits->rows[b][y] |= BIT(x);
+                tile &= tile - 1;
+            }
+        }
+    }
+}
+
+void bits_to_level(Level_Bits * bits, Level level) {
+    memset(level, 0, sizeof(Level));
+    for (int b = 0; b < BOARD_PLANES; ++b) {
+        if (!(bits->planes & BIT(b))) continue;
+        for (int y = 0; y < LEVEL_SIZE; ++y) {
+            u32 row = bits->rows[b][y];
+            while (row) {
+                level[__builtin_ctz(row) + y * LEVEL_SIZE] |= BIT(b);
+                row &= row - 1;
+            }
+        }
+    }
+}
+
+// Swaps rows and columns of a 32 by 32 board, so bit x of row y becomes
+// bit y of row x. The top right and bottom left 16 by 16 blocks are swapped,
+// then the same inside each block at 8 by 8, and so on down to single bits.
+void transpose_board(u32 * rows) {
+    u32 mask = 0x0000ffff;
+    for (int j = 16; j != 0; j >>= 1, mask ^= mask << j) {
+        for (int k = 0; k < BOARD_SIZE; k = (k + j + 1) & ~j) {
+            u32 t = ((rows[k] >> j) ^ rows[k + j]) & mask;
+            rows[k + j] ^= t;
+            rows[k] ^= t << j;
+        }
+    }
+}
+
+u32 reverse_bits(u32 v) {
+    v = (v >> 1 & 0x55555555) | (v & 0x55555555) << 1;
+    v = (v >> 2 & 0x33333333) | (v & 0x33333333) << 2;
+    v = (v >> 4 & 0x0f0f0f0f) | (v & 0x0f0f0f0f) << 4;
+    v = (v >> 8 & 0x00ff00ff) | (v & 0x00ff00ff) << 8;
+    return v >> 16 | v << 16;
+}
+
+// Makes one of the 8 variants of a level, made of the steps in 'symmetry'.
+void apply_symmetry(Level_Bits * in, int symmetry, Level_Bits * out) {
+    out->planes = in->planes;
+    for (int b = 0; b < BOARD_PLANES; ++b) {
+        u32 * rows = out->rows[b];
+        if (!(in->planes & BIT(b))) {
+            memset(rows, 0, sizeof(out->rows[b]));
+            continue;
+        }
+        memcpy(rows, in->rows[b], sizeof(out->rows[b]));
+        // The level stays in the top left corner of the board.
+        if (symmetry & TRANSPOSE) transpose_board(rows);
+        if (symmetry & FLIP_X) {
+            for (int y = 0; y < LEVEL_SIZE; ++y) rows[y] = reverse_bits(rows[y]) >> (BOARD_SIZE - LEVEL_SIZE);
+        }
+        if (symmetry & FLIP_Y) {
+            for (int y = 0; y < LEVEL_SIZE / 2; ++y) {
+                u32 swap = rows[y];
+                rows[y] = rows[LEVEL_SIZE - 1 - y];
+                rows[LEVEL_SIZE - 1 - y] = swap;
+            }
+        }
+    }
+}
+
+// Orders levels by their bitboards, as if they were one long number.
+int compare_level_bits(Level_Bits * a, Level_Bits * b) {
+    if (a->planes != b->planes) return a->planes < b->planes ? -1 : 1;
+    for (int p = 0; p < BOARD_PLANES; ++p) {
+        if (!(a->planes & BIT(p))) continue;
+        for (int y = 0; y < LEVEL_SIZE; ++y) {
+            if (a->rows[p][y] != b->rows[p][y]) return a->rows[p][y] < b->rows[p][y] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+u64 hash_level_bits(Level_Bits * bits) {
+    u64 hash = bits->planes;
+    for (int p = 0; p < BOARD_PLANES; ++p) {
+        if (!(bits->planes & BIT(p))) continue;
+        for (int y = 0; y < LEVEL_SIZE; ++y) {
+            hash = (hash ^ bits->rows[p][y]) * 0x9e3779b97f4a7c15;
+            hash ^= hash >> 29;
+        }
+    }
+    return hash;
+}
+
+// Puts the canonical variant of a level in 'out', which is the lowest of the
+// 8 by compare_level_bits, so every variant of a level gives the same one.
+// Returns the steps that turn the level into it.
+int canonical_level_bits(Level level, Level_Bits * out) {
+    Level_Bits bits, variant;
+    level_to_bits(level, &bits);
+    *out = bits;
+    int best = 0;
+    for (int symmetry = 1; symmetry < SYMMETRY_COUNT; ++symmetry) {
+        apply_symmetry(&bits, symmetry, &variant);
+        if (compare_level_bits(&variant, out) < 0) {
+            *out = variant;
+            best = symmetry;
+        }
+    }
+    return best;
+}
+
+// Hash that is the same for a level and all of its rotations and reflections.
+u64 canonical_level_hash(Level level) {
+    Level_Bits canonical;
+    canonical_level_bits(level, &canonical);
+    return hash_level_bits(&canonical);
+}
+
+// Puts every different variant of a level in 'out', the level itself first.
+// A level that is the same when turned or mirrored has fewer than 8.
+// Returns the number of variants.
+int level_variants(Level level, Level out[SYMMETRY_COUNT]) {
+    Level_Bits bits, variants[SYMMETRY_COUNT];
+    level_to_bits(level, &bits);
+    int count = 0;
+    for (int symmetry = 0; symmetry < SYMMETRY_COUNT; ++symmetry) {
+        apply_symmetry(&bits, symmetry, &variants[count]);
+        bool repeat = false;
+        for (int i = 0; i < count && !repeat; ++i) {
+            repeat = compare_level_bits(&variants[i], &variants[count]) == 0;
+        }
+        if (repeat) continue;
+        bits_to_level(&variants[count], out[count]);
+        ++count;
+    }
+    return count;
+}
+
+#ifndef NO_MAIN
+
+int main(int argument_count, char ** arguments) {
+    bool write_variants = argument_count > 1 && strcmp(arguments[1], "variants") == 0;
+
+    // Hashes of the levels seen so far, in a table that grows to stay at
+    // most half full. Two different levels having the same 64 bit hash is
+    // unlikely enough to ignore.
+    u64 slot_count = 1024, used = 0;
+    u64 * slots = calloc(slot_count, sizeof(u64));
+    int level_count = 0, different_count = 0, written = 0;
+    double seconds = 0;
+    Level level, variants[SYMMETRY_COUNT];
+    while (slots && fread(level, sizeof(Level), 1, stdin) == 1) {
+        ++level_count;
+        double start = seconds_now();
+        // Zero marks an empty slot.
+        u64 hash = canonical_level_hash(level) | 1;
+        seconds += seconds_now() - start;
+
+        u64 i = hash & (slot_count - 1);
+        while (slots[i] && slots[i] != hash) i = (i + 1) & (slot_count - 1);
+        if (slots[i]) continue;
+        slots[i] = hash;
+        ++different_count;
+        if (write_variants) {
+            int count = level_variants(level, variants);
+            written += fwrite(variants, sizeof(Level), count, stdout);
+        }
+
+        if (++used * 2 > slot_count) {
+            u64 * old = slots;
+            u64 old_count = slot_count;
+            slot_count *= 2;
+            slots = calloc(slot_count, sizeof(u64));
+            for (u64 s = 0; slots && s < old_count; ++s) {
+                if (!old[s]) continue;
+                u64 j = old[s] & (slot_count - 1);
+                while (slots[j]) j = (j + 1) & (slot_count - 1);
+                slots[j] = old[s];
+            }
+            free(old);
+        }
+    }
+    if (!slots) {
+        fprintf(stderr, "Not enough memory.\n");
+        return 1;
+    }
+
+    fprintf(stderr, "%d levels, %d different when turned and mirrored ones count as the same.\n",
+        level_count, different_count);
+    fprintf(stderr, "Canonical hashes took %.3f s (%.0f levels per second).\n",
+        seconds, seconds > 0 ? level_count / seconds : 0);
+    if (write_variants) fprintf(stderr, "Wrote %d variants.\n", written);
+    free(slots);
+}
+
+#endif
@@ -0,0 +1,102 @@
+/*
+    telemetry.c
+    In-memory buffer of game events, written out to a file in the background.
+
+    The game pushes events into a ring buffer, and a second thread drains it
+    into a file. There is one writer and one reader, so the two sides only need
+    to agree on the head and tail counters, and neither side ever waits for the
+    other. If the ring is full the event is dropped and counted, rather than
+    stalling the frame loop.
+
+    Events are written as CSV, or in binary: a header of three u32s (the
+    magic number, the version and the size of an event), then 12 bytes for
+    each event: the step as a u32, the type, x and y as u8s, a zero byte,
+    and the frame time as a float.
+*/
+
+#pragma once
+
+#include <stdatomic.h>
+#include "common.c"
+
+// Types of event.
+#define EVENT_STEP  1
+#define EVENT_GOLD  2
+#define EVENT_KILL  3
+#define EVENT_KEY   4
+#define EVENT_EXIT  5
+#define EVENT_DEATH 6
+
+typedef struct {
+    u32 step;
+    u8 type;
+    u8 x, y;
+    // Time taken by the frame the event happened in, in milliseconds.
+    float frame_time;
+} Telemetry_Event;
+
+// Must be a power of two.
+#define TELEMETRY_CAPACITY 4096
+
+#define TELEMETRY_MAGIC 0x4d454c54
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_EVENT_SIZE 12
+
+typedef struct {
+    Telemetry_Event events[TELEMETRY_CAPACITY];
+    // Total number of events ever pushed, and ever flushed.
+    _Atomic u64 head;
+    _Atomic u64 tail;
+    _Atomic u64 dropped;
+} Telemetry;
+
+// Called only by the game thread.
+// Returns false if the event was dropped because the ring was full.
+bool record_event(Telemetry * telemetry, Telemetry_Event event) {
+    u64 head = atomic_load_explicit(&telemetry->head, memory_order_relaxed);
+    u64 tail = atomic_load_explicit(&telemetry->tail, memory_order_acquire);
+    if (head - tail == TELEMETRY_CAPACITY) {
+        atomic_fetch_add_explicit(&telemetry->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+    telemetry->events[head & (TELEMETRY_CAPACITY - 1)] = event;
+    // Publish the event only after it has been written.
+    atomic_store_explicit(&telemetry->head, head + 1, memory_order_release);
+    return true;
+}
+
+void write_telemetry_header(FILE * file, bool csv) {
+    if (csv) {
+        fprintf(file, "step,type,x,y,frame_time\n");
+    } else {
+        u32 header[3] = { TELEMETRY_MAGIC, TELEMETRY_VERSION, TELEMETRY_EVENT_SIZE };
+        fwrite(header, sizeof(header), 1, file);
+    }
+}
+
+// Called only by the thread that writes the file.
+// Writes out every event pushed so far. Returns how many there were.
+int flush_telemetry(Telemetry * telemetry, FILE * file, bool csv) {
+    u64 tail = atomic_load_explicit(&telemetry->tail, memory_order_relaxed);
+    u64 head = atomic_load_explicit(&telemetry->head, memory_order_acquire);
+    for (u64 i = tail; i < head; ++i) {
+        Telemetry_Event * event = &telemetry->events[i & (TELEMETRY_CAPACITY - 1)];
+        if (csv) {
+            fprintf(file, "%u,%d,%d,%d,%.3f\n",
+                event->step, event->type, event->x, event->y, event->frame_time);
+        } else {
+            // Written a field at a time, so the padding in the struct never
+            // reaches the file.
+            u8 bytes[TELEMETRY_EVENT_SIZE] = {0};
+            memcpy(&bytes[0], &event->step, sizeof(u32));
+            bytes[4] = event->type;
+            bytes[5] = event->x;
+            bytes[6] = event->y;
+            memcpy(&bytes[8], &event->frame_time, sizeof(float));
+            fwrite(bytes, sizeof(bytes), 1, file);
+        }
+    }
+    // Hand the slots back to the game once they have been read.
+    atomic_store_explicit(&telemetry->tail, head, memory_order_release);
+    return head - tail;
+}
@@ -0,0 +1,236 @@
+/*
+    validate.c
+    Checks that levels are well formed before they are played or used.
+
+    Reading a level only checks that the file was long enough, so a corrupt
+    or hand edited level is taken as it is, and breaks the game later. A level
+    is well formed if it has:
+      - one player and one exit, and at least one key (the chokepoint placer
+        can place more than one, and the game handles that),
+      - walls all around the edge,
+      - no bits set above the last entity type,
+      - a lock only on the exit.
+
+    Each level is checked in one pass, 8 tiles at a time with SSE2, keeping
+    counts of players, keys and exits and a record of any bad bits, without
+    any branches. Only levels that fail are looked at tile by tile to find
+    where, so a large set of levels is checked about as fast as it is read.
+
+    Build with `cc -O2 validate.c -o validate`.
+    Run with `./validate < levels` to check a set of levels saved one after
+    another. Each bad level is listed by its index in the set.
+*/
+
+#include "common.c"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Problems that a level can have, as bits.
+#define LEVEL_BAD_BITS   BIT(0)
+#define LEVEL_BAD_BORDER BIT(1)
+#define LEVEL_BAD_LOCK   BIT(2)
+#define LEVEL_BAD_PLAYER BIT(3)
+#define LEVEL_BAD_KEY    BIT(4)
+#define LEVEL_BAD_EXIT   BIT(5)
+#define LEVEL_PROBLEM_COUNT 6
+
+// Bits of a tile that are not any entity.
+#define UNDEFINED_BITS ((Tile)~(BIT(ENTITY_TYPE_COUNT + 1) - 1))
+
+char * level_problem_names[LEVEL_PROBLEM_COUNT] = {
+    "bits set that are not entities",
+    "no wall on the edge",
+    "a lock that is not on the exit",
+    "not one player",
+    "no key",
+    "not one exit",
+};
+
+bool is_border_tile(int x, int y) {
+    return x == 0 || y == 0 || x == LEVEL_SIZE - 1 || y == LEVEL_SIZE - 1;
+}
+
+// Gives the problems with one tile, for those that are about single tiles.
+int tile_problems(Tile tile, int x, int y) {
+    int problems = 0;
+    if (tile & UNDEFINED_BITS) problems |= LEVEL_BAD_BITS;
+    if (is_border_tile(x, y) && !(tile & BIT(WALL))) problems |= LEVEL_BAD_BORDER;
+    if ((tile & BIT(LOCK)) && !(tile & BIT(EXIT))) problems |= LEVEL_BAD_LOCK;
+    return problems;
+}
+
+int count_problems(int players, int keys, int exits) {
+    int problems = 0;
+    if (players != 1) problems |= LEVEL_BAD_PLAYER;
+    if (keys < 1)     problems |= LEVEL_BAD_KEY;
+    if (exits != 1)   problems |= LEVEL_BAD_EXIT;
+    return problems;
+}
+
+// Returns the problems with a level, as LEVEL_BAD bits, or 0 if it is well formed.
+int level_problems_scalar(Level level) {
+    int problems = 0, players = 0, keys = 0, exits = 0;
+    for (int y = 0; y < LEVEL_SIZE; ++y) {
+        for (int x = 0; x < LEVEL_SIZE; ++x) {
+            Tile tile = level[x + y * LEVEL_SIZE];
+            problems |= tile_problems(tile, x, y);
+            players += (tile >> PLAYER) & 1;
+            keys    += (tile >> KEY) & 1;
+            exits   += (tile >> EXIT) & 1;
+        }
+    }
+    return problems | count_problems(players, keys, exits);
+}
+
+#if defined(__x86_64__)
+int sum_u16_lanes(__m128i v) {
+    v = _mm_add_epi16(v, _mm_srli_si128(v, 8));
+    v = _mm_add_epi16(v, _mm_srli_si128(v, 4));
+    v = _mm_add_epi16(v, _mm_srli_si128(v, 2));
+    return _mm_extract_epi16(v, 0);
+}
+
+// Same as level_problems_scalar, 8 tiles at a time.
+int level_problems_sse2(Level level) {
+    int tile_count = LEVEL_SIZE * LEVEL_SIZE;
+    __m128i one       = _mm_set1_epi16(1);
+    __m128i undefined = _mm_set1_epi16(UNDEFINED_BITS);
+    __m128i exit_bit  = _mm_set1_epi16(BIT(EXIT));
+    __m128i wall_bit  = _mm_set1_epi16(BIT(WALL));
+    __m128i players = _mm_setzero_si128(), keys = players, exits = players;
+    __m128i bad_bits = players, bad_locks = players;
+
+    #define CHECK_TILES(tiles) { \
+        __m128i t = (tiles); \
+        players = _mm_add_epi16(players, _mm_and_si128(_mm_srli_epi16(t, PLAYER), one)); \
+        keys    = _mm_add_epi16(keys,    _mm_and_si128(_mm_srli_epi16(t, KEY), one)); \
+        exits   = _mm_add_epi16(exits,   _mm_and_si128(_mm_srli_epi16(t, EXIT), one)); \
+        bad_bits = _mm_or_si128(bad_bits, _mm_and_si128(t, undefined)); \
+        /* The lock bit moved down onto the exit bit, where there is no exit. */ \
+        __m128i lock_at_exit = _mm_and_si128(_mm_srli_epi16(t, LOCK - EXIT), exit_bit); \
+        bad_locks = _mm_or_si128(bad_locks, _mm_andnot_si128(t, lock_at_exit)); \
+    }
+    int i = 0;
+    for (; i + 8 <= tile_count; i += 8) CHECK_TILES(_mm_loadu_si128((__m128i *)&level[i]));
+    // The last few tiles, with the rest of the lanes zero, which counts as nothing.
+    for (; i < tile_count; i += 4) CHECK_TILES(_mm_loadl_epi64((__m128i *)&level[i]));
+    #undef CHECK_TILES
+
+    // The top and bottom rows, in 8 tile pieces that overlap at the end.
+    __m128i edge = wall_bit;
+    for (int y = 0; y < LEVEL_SIZE; y += LEVEL_SIZE - 1) {
+        Tile * row = &level[y * LEVEL_SIZE];
+        for (int x = 0; x < LEVEL_SIZE; x += 8) {
+            edge = _mm_and_si128(edge, _mm_loadu_si128((__m128i *)&row[MIN(x, LEVEL_SIZE - 8)]));
+        }
+    }
+    // The right end of each row is next to the left end of the row after, so
+    // the left and right columns are read two tiles at a time.
+    u32 sides = BIT(WALL) | BIT(WALL) << 16;
+    for (int y = 0; y < LEVEL_SIZE - 1; ++y) {
+        u32 pair;
+        memcpy(&pair, &level[LEVEL_SIZE - 1 + y * LEVEL_SIZE], sizeof(pair));
+        sides &= pair;
+    }
+
+    int problems = count_problems(sum_u16_lanes(players), sum_u16_lanes(keys), sum_u16_lanes(exits));
+    __m128i zero = _mm_setzero_si128();
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(bad_bits, zero)) != 0xffff) problems |= LEVEL_BAD_BITS;
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(bad_locks, zero)) != 0xffff) problems |= LEVEL_BAD_LOCK;
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(edge, wall_bit)) != 0xffff
+        || sides != (BIT(WALL) | BIT(WALL) << 16)) problems |= LEVEL_BAD_BORDER;
+    return problems;
+}
+#endif
+
+// Returns the problems with a level, as LEVEL_BAD bits, or 0 if it is well formed.
+int level_problems(Level level) {
+#if defined(__x86_64__)
+    return level_problems_sse2(level);
+#else
+    return level_problems_scalar(level);
+#endif
+}
+
+// Finds the first tile with one of the problems that are about single
+// tiles. Returns its index, or -1 if there is none.
+int find_problem_tile(Level level, int problems) {
+    for (int y = 0; y < LEVEL_SIZE; ++y) {
+        for (int x = 0; x < LEVEL_SIZE; ++x) {
+            if (tile_problems(level[x + y * LEVEL_SIZE], x, y) & problems) return x + y * LEVEL_SIZE;
+        }
+    }
+    return -1;
+}
+
+// Checks 'count' levels stored one after another. The index and problems
+// of the first 'max_bad' bad levels are put in 'bad' and 'bad_problems'.
+// Returns the number of bad levels, which can be more than 'max_bad'.
+size_t validate_levels(Tile * levels, size_t count, size_t * bad, int * bad_problems, size_t max_bad) {
+    size_t bad_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+        int problems = level_problems(&levels[i * LEVEL_SIZE * LEVEL_SIZE]);
+        if (!problems) continue;
+        if (bad_count < max_bad) {
+            bad[bad_count] = i;
+            bad_problems[bad_count] = problems;
+        }
+        ++bad_count;
+    }
+    return bad_count;
+}
+
+// Prints what is wrong with a level, with the place of the first bad tile.
+void print_level_problems(FILE * file, Level level, int problems) {
+    for (int p = 0; p < LEVEL_PROBLEM_COUNT; ++p) {
+        if (!(problems & BIT(p))) continue;
+        fprintf(file, "  %s", level_problem_names[p]);
+        int tile = find_problem_tile(level, BIT(p));
+        if (tile >= 0) fprintf(file, " at %d, %d", tile % LEVEL_SIZE, tile / LEVEL_SIZE);
+        fprintf(file, "\n");
+    }
+}
+
+#ifndef NO_MAIN
+
+int main(int argument_count, char ** arguments) {
+    // Levels are read and checked a batch at a time.
+    enum { BATCH = 4096 };
+    Tile * levels = malloc(sizeof(Level) * BATCH);
+    size_t bad[BATCH];
+    int bad_problems[BATCH];
+    if (!levels) return 1;
+
+    size_t level_count = 0, bad_count = 0;
+    double seconds = 0;
+    size_t bytes;
+    while ((bytes = fread(levels, 1, sizeof(Level) * BATCH, stdin)) > 0) {
+        size_t read = bytes / sizeof(Level);
+        double start = seconds_now();
+        size_t batch_bad = validate_levels(levels, read, bad, bad_problems, BATCH);
+        seconds += seconds_now() - start;
+        for (size_t i = 0; i < batch_bad; ++i) {
+            printf("Level %zu:\n", level_count + bad[i]);
+            print_level_problems(stdout, &levels[bad[i] * LEVEL_SIZE * LEVEL_SIZE], bad_problems[i]);
+        }
+        if (bytes % sizeof(Level)) {
+            printf("Level %zu:\n  cut short, only %zu bytes\n", level_count + read, bytes % sizeof(Level));
+            ++bad_count;
+        }
+        level_count += read;
+        bad_count += batch_bad;
+    }
+    if (ferror(stdin) || !feof(stdin)) {
+        fprintf(stderr, "Could not read the levels.\n");
+        return 1;
+    }
+
+    fprintf(stderr, "%zu levels, %zu bad. Checked in %.3f s (%.2f GB per second)\n",
+        level_count, bad_count, seconds, seconds > 0 ? level_count * sizeof(Level) / seconds / 1e9 : 0);
+    free(levels);
+    return bad_count > 0;
+}
+
+#endif
@@ -0,0 +1,326 @@
+/*
+    world.c
+    Coarse-to-fine generation of large maps, made of many level-sized blocks.
+
+    Running the level generators over a whole 4096 by 4096 map is far too slow,
+    so instead a coarse layout is made first, with one tile per block of the
+    map. The coarse layout decides which neighbouring blocks are joined and
+    where the doors between them go. Then each block is refined on its own by
+    the usual level generators, with the doors it was given carved through to
+    its rooms. Blocks do not depend on each other once the coarse layout is
+    made, so they are refined in parallel. The finished map is checked to have
+    all of its floor joined up, as a door that finds no floor to dig through
+    to would cut a block off.
+
+    Each block is seeded from its position, so the same world is made
+    whatever the number of threads.
+
+    Build with `cc world.c -o world -pthread`.
+    Run with `./world blocks_across blocks_down [threads] > out.map`.
+*/
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#define NO_MAIN
+#include "level.c"
+#include "stream.c"
+
+// Doors are never put in the corners of a block.
+#define NO_DOOR -1
+
+typedef struct {
+    int blocks_x, blocks_y;
+    // Offset along the border of the door on the right and bottom side of
+    // each block, or NO_DOOR.
+    s8 * door_right;
+    s8 * door_down;
+    u64 seed;
+} Coarse_Layout;
+
+// Chance that blocks already joined by the spanning tree get an extra door,
+// so that there is more than one way around.
+#define EXTRA_DOOR_CHANCE 0.15f
+
+int random_door() {
+    return random_int_range(2, LEVEL_SIZE - 3);
+}
+
+int find_root(int * parent, int i) {
+    while (parent[i] != i) i = parent[i] = parent[parent[i]];
+    return i;
+}
+
+// Joins the blocks together with a random spanning tree, so every block can be
+// reached, then adds a few extra doors to make loops.
+void make_coarse_layout(Coarse_Layout * layout, int blocks_x, int blocks_y, u64 seed) {
+    int count = blocks_x * blocks_y;
+    *layout = (Coarse_Layout){ blocks_x, blocks_y, malloc(count), malloc(count), seed };
+    memset(layout->door_right, NO_DOOR, count);
+    memset(layout->door_down, NO_DOOR, count);
+
+    reset_seed(seed, 0);
+
+    // Randomised Kruskal: visit every edge between blocks in a random order,
+    // and open it if it joins two blocks that are not yet connected.
+    int edge_count = 2 * count;
+    int * edges = malloc(sizeof(int) * edge_count);
+    int * parent = malloc(sizeof(int) * count);
+    for (int i = 0; i < edge_count; ++i) edges[i] = i;
+    for (int i = 0; i < count; ++i) parent[i] = i;
+    for (int i = edge_count - 1; i > 0; --i) {
+        int j = random_int_range(0, i);
+        int swap = edges[i];
+        edges[i] = edges[j];
+        edges[j] = swap;
+    }
+
+    for (int i = 0; i < edge_count; ++i) {
+        int block = edges[i] / 2;
+        bool right = edges[i] % 2 == 0;
+        int bx = block % blocks_x;
+        int by = block / blocks_x;
+        if (right && bx == blocks_x - 1) continue;
+        if (!right && by == blocks_y - 1) continue;
+        int other = right ? block + 1 : block + blocks_x;
+
+        int a = find_root(parent, block);
+        int b = find_root(parent, other);
+        if (a == b && !chance(EXTRA_DOOR_CHANCE)) continue;
+        parent[b] = a;
+        if (right) layout->door_right[block] = random_door();
+        else       layout->door_down[block]  = random_door();
+    }
+
+    free(edges);
+    free(parent);
+}
+
+void free_coarse_layout(Coarse_Layout * layout) {
+    free(layout->door_right);
+    free(layout->door_down);
+}
+
+// Opens a door in the border of a level, and digs the shortest way inward from
+// it to a tile that is already floor. Going straight in is not enough, as it
+// can miss the rooms altogether and come out at the other side of the level.
+void carve_door(Level level, int side, int offset) {
+    int x, y;
+    if (side == UP)    { x = offset; y = 0;              } else
+    if (side == DOWN)  { x = offset; y = LEVEL_SIZE - 1; } else
+    if (side == LEFT)  { x = 0;              y = offset; } else
+                       { x = LEVEL_SIZE - 1; y = offset; }
+
+    enum { TILE_COUNT = LEVEL_SIZE * LEVEL_SIZE };
+    s16 came_from[TILE_COUNT];
+    s16 queue[TILE_COUNT];
+    for (int i = 0; i < TILE_COUNT; ++i) came_from[i] = -1;
+
+    int door = x + y * LEVEL_SIZE;
+    int head = 0, tail = 0, found = -1;
+    came_from[door] = door;
+    queue[tail++] = door;
+    while (head < tail && found < 0) {
+        int tile = queue[head++];
+        int tx = tile % LEVEL_SIZE;
+        int ty = tile / LEVEL_SIZE;
+        int neighbours[4][2] = { {tx, ty-1}, {tx, ty+1}, {tx-1, ty}, {tx+1, ty} };
+        for (int n = 0; n < 4; ++n) {
+            int nx = neighbours[n][0];
+            int ny = neighbours[n][1];
+            // Only dig through the inside, so the border stays wall apart from the door.
+            if (nx < 1 || ny < 1 || nx >= LEVEL_SIZE - 1 || ny >= LEVEL_SIZE - 1) continue;
+            int next = nx + ny * LEVEL_SIZE;
+            if (came_from[next] >= 0) continue;
+            came_from[next] = tile;
+            if (level[next] & BIT(FLOOR)) {
+                found = next;
+                break;
+            }
+            queue[tail++] = next;
+        }
+    }
+
+    level[door] = BIT(FLOOR);
+    if (found < 0) return;
+    for (int tile = came_from[found]; tile != door; tile = came_from[tile]) {
+        level[tile] = BIT(FLOOR);
+    }
+}
+
+// Turns every floor tile outside the largest joined up area into wall.
+void keep_largest_area(Level level) {
+    enum { TILE_COUNT = LEVEL_SIZE * LEVEL_SIZE };
+    s16 area[TILE_COUNT];
+    s16 queue[TILE_COUNT];
+    int largest_area = -1, largest_size = 0, area_count = 0;
+    for (int i = 0; i < TILE_COUNT; ++i) area[i] = -1;
+    for (int i = 0; i < TILE_COUNT; ++i) {
+        if (area[i] >= 0 || (level[i] & BIT(FLOOR)) == 0) continue;
+        int head = 0, tail = 0;
+        area[i] = area_count;
+        queue[tail++] = i;
+        while (head < tail) {
+            int tile = queue[head++];
+            int x = tile % LEVEL_SIZE;
+            int y = tile / LEVEL_SIZE;
+            int neighbours[4][2] = { {x, y-1}, {x, y+1}, {x-1, y}, {x+1, y} };
+            for (int n = 0; n < 4; ++n) {
+                int nx = neighbours[n][0];
+                int ny = neighbours[n][1];
+                if (nx < 0 || ny < 0 || nx >= LEVEL_SIZE || ny >= LEVEL_SIZE) continue;
+                int next = nx + ny * LEVEL_SIZE;
+                if (area[next] >= 0 || (level[next] & BIT(FLOOR)) == 0) continue;
+                area[next] = area_count;
+                queue[tail++] = next;
+            }
+        }
+        if (tail > largest_size) {
+            largest_size = tail;
+            largest_area = area_count;
+        }
+        ++area_count;
+    }
+    for (int i = 0; i < TILE_COUNT; ++i) {
+        if (level[i] & BIT(FLOOR) && area[i] != largest_area) level[i] = BIT(WALL);
+    }
+}
+
+// Makes the level for one block, with the doors the coarse layout gave it.
+void refine_block(Coarse_Layout * layout, int block, Level level) {
+    int bx = block % layout->blocks_x;
+    int by = block / layout->blocks_x;
+    reset_seed(layout->seed, block + 1);
+
+    fill_level(level, WALL);
+    digger_generator(level, NULL);
+    if (chance(0.3f)) basic_room_generator(level);
+
+    // The digger can leave a stray tile on the border, so make sure there is
+    // only one area of floor. Then every door dug through to the floor
+    // is joined to every other.
+    keep_largest_area(level);
+
+    if (layout->door_right[block] != NO_DOOR) carve_door(level, RIGHT, layout->door_right[block]);
+    if (layout->door_down[block]  != NO_DOOR) carve_door(level, DOWN,  layout->door_down[block]);
+    if (bx > 0 && layout->door_right[block - 1] != NO_DOOR) {
+        carve_door(level, LEFT, layout->door_right[block - 1]);
+    }
+    if (by > 0 && layout->door_down[block - layout->blocks_x] != NO_DOOR) {
+        carve_door(level, UP, layout->door_down[block - layout->blocks_x]);
+    }
+}
+
+typedef struct {
+    Coarse_Layout * layout;
+    Map * map;
+    _Atomic int next_block;
+} Refine_Work;
+
+// Each thread takes the next block that has not been started, until none are left.
+void * refine_thread(void * data) {
+    Refine_Work * work = data;
+    Coarse_Layout * layout = work->layout;
+    int count = layout->blocks_x * layout->blocks_y;
+    while (true) {
+        int block = atomic_fetch_add(&work->next_block, 1);
+        if (block >= count) break;
+
+        Level level;
+        refine_block(layout, block, level);
+
+        int x0 = (block % layout->blocks_x) * LEVEL_SIZE;
+        int y0 = (block / layout->blocks_x) * LEVEL_SIZE;
+        for (int y = 0; y < LEVEL_SIZE; ++y) {
+            for (int x = 0; x < LEVEL_SIZE; ++x) {
+                *map_tile(work->map, x0 + x, y0 + y) = level[x + y * LEVEL_SIZE];
+            }
+        }
+    }
+    return NULL;
+}
+
+bool count_flood_tile(Tile * tile, int x, int y, void * data) {
+    return false;
+}
+
+// Checks that every floor tile of the map can be reached from every other.
+bool world_is_connected(Map * map) {
+    s64 floor_count = 0;
+    int start_x = -1, start_y = -1;
+    for (int y = 0; y < map->height; ++y) {
+        for (int x = 0; x < map->width; ++x) {
+            if ((*map_tile(map, x, y) & BIT(FLOOR)) == 0) continue;
+            if (floor_count++ == 0) {
+                start_x = x;
+                start_y = y;
+            }
+        }
+    }
+    if (floor_count == 0) return false;
+    return map_flood(map, start_x, start_y, BIT(FLOOR), BIT(FLOOR), count_flood_tile, NULL) == floor_count;
+}
+
+// Generates a map of blocks_x by blocks_y blocks, each the size of a level.
+// Returns false if the floor of the finished map is not all joined up.
+bool generate_world(Map * map, int blocks_x, int blocks_y, u64 seed, int thread_count) {
+    forget_wall_distance(map);
+    Coarse_Layout layout;
+    make_coarse_layout(&layout, blocks_x, blocks_y, seed);
+
+    Refine_Work work = { &layout, map, 0 };
+    pthread_t threads[thread_count];
+    int started = 0;
+    for (int i = 1; i < thread_count; ++i) {
+        if (pthread_create(&threads[started], NULL, refine_thread, &work) == 0) ++started;
+    }
+    // This thread helps too, so the world is made even if no threads could be started.
+    refine_thread(&work);
+    for (int i = 0; i < started; ++i) pthread_join(threads[i], NULL);
+
+    free_coarse_layout(&layout);
+    return world_is_connected(map);
+}
+
+// Puts a tile's entity on the first empty floor tile of a block.
+bool place_in_block(Map * map, int blocks_x, int block, Tile entities) {
+    int x0 = (block % blocks_x) * LEVEL_SIZE;
+    int y0 = (block / blocks_x) * LEVEL_SIZE;
+    for (int y = 1; y < LEVEL_SIZE - 1; ++y) {
+        for (int x = 1; x < LEVEL_SIZE - 1; ++x) {
+            Tile * tile = map_tile(map, x0 + x, y0 + y);
+            if (*tile == BIT(FLOOR)) {
+                *tile |= entities;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+int main(int argument_count, char ** arguments) {
+    int blocks_x = argument_count > 1 ? atoi(arguments[1]) : 8;
+    int blocks_y = argument_count > 2 ? atoi(arguments[2]) : 8;
+    int thread_count = argument_count > 3 ? atoi(arguments[3]) : sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = MAX(1, thread_count);
+
+    Map map = make_map(blocks_x * LEVEL_SIZE, blocks_y * LEVEL_SIZE);
+    if (!map.tiles || !generate_world(&map, blocks_x, blocks_y, 1, thread_count)) {
+        fprintf(stderr, "Could not generate the world.\n");
+        return 1;
+    }
+
+    // Player in the first block, key in the middle, and the exit in the last.
+    int count = blocks_x * blocks_y;
+    place_in_block(&map, blocks_x, 0, BIT(PLAYER));
+    place_in_block(&map, blocks_x, count / 2, BIT(KEY));
+    place_in_block(&map, blocks_x, count - 1, BIT(EXIT) | BIT(LOCK));
+
+    Row_Writer writer;
+    if (!begin_row_writer(&writer, stdout, map.width, map.height)) return 1;
+    for (int y = 0; y < map.height; ++y) write_row(map_tile(&map, 0, y), y, &writer);
+    if (!end_row_writer(&writer)) return 1;
+
+    free_map(&map);
+}
@@ -0,0 +1,410 @@
+/*
+    writer.c
+    Writes levels to a file in the background, so generating them never waits on the disk.
+
+    Workers fill buffers of levels and hand each full one to the writer,
+    taking an empty one back straight away. Each buffer is given the next
+    place in the file as it is handed over, and a single writer thread writes
+    it there, so the file holds the buffers in the order they were handed over,
+    and the worker knows where its levels went.
+
+    On Linux the writer thread keeps many writes going at once with io_uring,
+    set up with the system calls directly, as there is no library for it here:
+    it puts writes in the submission ring, and takes them out of the completion
+    ring as the disk finishes them. Where io_uring is not there, or not
+    allowed, the writer thread writes each buffer in turn with pwrite. Either
+    way the workers carry on while it does.
+
+    Workers only wait if every buffer is waiting to be written, which means
+    the disk cannot keep up, and waiting is better than running out of memory.
+
+    See batch.c for a program that uses it.
+*/
+
+#pragma once
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "common.c"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+typedef struct Write_Buffer {
+    struct Write_Buffer * next;
+    // Bytes in the buffer, and how many of them have been written so far.
+    size_t size, written;
+    // Where in the file the buffer goes.
+    u64 offset;
+    u8 * bytes;
+} Write_Buffer;
+
+#if defined(__linux__)
+typedef struct {
+    int fd;
+    u32 entries;
+    u32 * sq_head, * sq_tail, * sq_mask, * sq_array;
+    u32 * cq_head, * cq_tail, * cq_mask;
+    struct io_uring_sqe * sqes;
+    struct io_uring_cqe * cqes;
+    void * sq_ring, * cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+} Uring;
+#endif
+
+typedef struct {
+    int file;
+    size_t buffer_size;
+    int buffer_count, max_buffers;
+    bool use_uring;
+#if defined(__linux__)
+    Uring uring;
+#endif
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    // Signalled when there is something for the writer thread to do.
+    pthread_cond_t work;
+    // Signalled when a buffer has been written and is free again.
+    pthread_cond_t freed;
+    Write_Buffer * free_buffers;
+    Write_Buffer * queue_head, * queue_tail;
+    bool closing;
+    bool failed;
+
+    // End of the last buffer queued, where the next one goes in the file.
+    u64 end_offset;
+    // Only used by the writer thread.
+    int in_flight;
+
+    // Totals, for reporting.
+    u64 bytes_written;
+    int most_queued, queued;
+} Level_Writer;
+
+#if defined(__linux__)
+
+void close_uring(Uring * uring) {
+    if (uring->sqes) munmap(uring->sqes, uring->sqes_size);
+    if (uring->cq_ring && uring->cq_ring != uring->sq_ring) munmap(uring->cq_ring, uring->cq_ring_size);
+    if (uring->sq_ring) munmap(uring->sq_ring, uring->sq_ring_size);
+    if (uring->fd >= 0) close(uring->fd);
+    *uring = (Uring){ .fd = -1 };
+}
+
+// Sets up a ring with room for 'entries' writes at once.
+// Returns false if the kernel does not have io_uring, or does not allow it.
+bool open_uring(Uring * uring, u32 entries) {
+    *uring = (Uring){ .fd = -1 };
+    struct io_uring_params params = {0};
+    uring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (uring->fd < 0) return false;
+    uring->entries = params.sq_entries;
+
+    uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+    uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    // Newer kernels map both rings with one call.
+    bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_map) {
+        uring->sq_ring_size = uring->cq_ring_size = MAX(uring->sq_ring_size, uring->cq_ring_size);
+    }
+    uring->sq_ring = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+    if (uring->sq_ring == MAP_FAILED) {
+        uring->sq_ring = NULL;
+        close_uring(uring);
+        return false;
+    }
+    uring->cq_ring = uring->sq_ring;
+    if (!single_map) {
+        uring->cq_ring = mmap(NULL, uring->cq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING);
+        if (uring->cq_ring == MAP_FAILED) {
+            uring->cq_ring = NULL;
+            close_uring(uring);
+            return false;
+        }
+    }
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+    if (uring->sqes == MAP_FAILED) {
+        uring->sqes = NULL;
+        close_uring(uring);
+        return false;
+    }
+
+    u8 * sq = uring->sq_ring;
+    u8 * cq = uring->cq_ring;
+    uring->sq_head  = (u32 *)(sq + params.sq_off.head);
+    uring->sq_tail  = (u32 *)(sq + params.sq_off.tail);
+    uring->sq_mask  = (u32 *)(sq + params.sq_off.ring_mask);
+    uring->sq_array = (u32 *)(sq + params.sq_off.array);
+    uring->cq_head  = (u32 *)(cq + params.cq_off.head);
+    uring->cq_tail  = (u32 *)(cq + params.cq_off.tail);
+    uring->cq_mask  = (u32 *)(cq + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+// Puts a write of the rest of a buffer in the submission ring. The kernel
+// only sees it once uring_enter is called. Never called with the ring full,
+// as there are never more writes going than entries in the ring.
+void uring_queue_write(Uring * uring, int file, Write_Buffer * buffer) {
+    u32 tail = *uring->sq_tail;
+    u32 index = tail & *uring->sq_mask;
+    struct io_uring_sqe * sqe = &uring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = file;
+    sqe->addr = (u64)(uintptr_t)(buffer->bytes + buffer->written);
+    sqe->len = buffer->size - buffer->written;
+    sqe->off = buffer->offset + buffer->written;
+    sqe->user_data = (u64)(uintptr_t)buffer;
+    uring->sq_array[index] = index;
+    // The kernel must see the entry filled in before it sees the new tail.
+    __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Hands the kernel 'submit' new writes, and waits until at least 'wait' have finished.
+// Returns how many of the writes the kernel took, which may be fewer than
+// 'submit', or -1 on an error.
+int uring_enter(Uring * uring, u32 submit, u32 wait) {
+    while (true) {
+        int result = syscall(__NR_io_uring_enter, uring->fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (result >= 0) return result;
+        if (errno != EINTR) return -1;
+    }
+}
+
+#endif
+
+// Writes with pwrite until the whole buffer is written. Returns false on an error.
+bool pwrite_buffer(int file, Write_Buffer * buffer) {
+    while (buffer->written < buffer->size) {
+        ssize_t result = pwrite(file, buffer->bytes + buffer->written,
+            buffer->size - buffer->written, buffer->offset + buffer->written);
+        if (result < 0 && errno == EINTR) continue;
+        if (result <= 0) return false;
+        buffer->written += result;
+    }
+    return true;
+}
+
+// Gives a written buffer back to the workers.
+void free_write_buffer(Level_Writer * writer, Write_Buffer * buffer, bool ok) {
+    pthread_mutex_lock(&writer->lock);
+    if (!ok) writer->failed = true;
+    else writer->bytes_written += buffer->size;
+    buffer->size = 0;
+    buffer->next = writer->free_buffers;
+    writer->free_buffers = buffer;
+    pthread_cond_signal(&writer->freed);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+#if defined(__linux__)
+
+// Hands the kernel the 'count' writes just queued, for the buffers in
+// 'list', and counts the ones it takes as in flight. The kernel can take
+// fewer than it is given, so it is given the rest until it takes none, and
+// those left are taken back out of the ring and written with pwrite.
+void submit_uring_writes(Level_Writer * writer, Write_Buffer * list, u32 count) {
+    Uring * uring = &writer->uring;
+    u32 taken = 0;
+    while (taken < count) {
+        int result = uring_enter(uring, count - taken, 0);
+        if (result <= 0) break;
+        taken += result;
+    }
+    writer->in_flight += taken;
+    if (taken == count) return;
+
+    // The kernel takes writes in order, so the ones left are at the end.
+    __atomic_store_n(uring->sq_tail, *uring->sq_tail - (count - taken), __ATOMIC_RELEASE);
+    for (u32 i = 0; i < taken; ++i) list = list->next;
+    while (list) {
+        Write_Buffer * next = list->next;
+        free_write_buffer(writer, list, pwrite_buffer(writer->file, list));
+        list = next;
+    }
+}
+
+#endif
+
+void * level_writer_thread(void * data) {
+    Level_Writer * writer = data;
+    while (true) {
+        // Take what is queued, as much as there is room for in the ring.
+        pthread_mutex_lock(&writer->lock);
+        while (!writer->queue_head && !writer->in_flight && !writer->closing) {
+            pthread_cond_wait(&writer->work, &writer->lock);
+        }
+        if (!writer->queue_head && !writer->in_flight) {
+            pthread_mutex_unlock(&writer->lock);
+            break;
+        }
+        int room = 1;
+#if defined(__linux__)
+        if (writer->use_uring) room = writer->uring.entries - writer->in_flight;
+#endif
+        Write_Buffer * taken = NULL, ** last = &taken;
+        while (writer->queue_head && room > 0) {
+            Write_Buffer * buffer = writer->queue_head;
+            writer->queue_head = buffer->next;
+            if (!writer->queue_head) writer->queue_tail = NULL;
+            --writer->queued;
+            buffer->next = NULL;
+            *last = buffer;
+            last = &buffer->next;
+            --room;
+        }
+        pthread_mutex_unlock(&writer->lock);
+
+        if (!writer->use_uring) {
+            while (taken) {
+                Write_Buffer * next = taken->next;
+                free_write_buffer(writer, taken, pwrite_buffer(writer->file, taken));
+                taken = next;
+            }
+            continue;
+        }
+
+#if defined(__linux__)
+        Uring * uring = &writer->uring;
+        u32 submit = 0;
+        for (Write_Buffer * buffer = taken; buffer; buffer = buffer->next) {
+            uring_queue_write(uring, writer->file, buffer);
+            ++submit;
+        }
+        // Only wait for a write to finish if there was nothing new to start.
+        if (submit) submit_uring_writes(writer, taken, submit);
+        else uring_enter(uring, 0, 1);
+
+        u32 head = *uring->cq_head;
+        u32 tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+        u32 resubmit = 0;
+        Write_Buffer * partial = NULL, ** last_partial = &partial;
+        for (; head != tail; ++head) {
+            struct io_uring_cqe * cqe = &uring->cqes[head & *uring->cq_mask];
+            Write_Buffer * buffer = (Write_Buffer *)(uintptr_t)cqe->user_data;
+            --writer->in_flight;
+            if (cqe->res > 0) buffer->written += cqe->res;
+            if (cqe->res > 0 && buffer->written < buffer->size) {
+                // Only part of it was written, so write the rest.
+                uring_queue_write(uring, writer->file, buffer);
+                buffer->next = NULL;
+                *last_partial = buffer;
+                last_partial = &buffer->next;
+                ++resubmit;
+                continue;
+            }
+            free_write_buffer(writer, buffer, cqe->res > 0);
+        }
+        __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+        if (resubmit) submit_uring_writes(writer, partial, resubmit);
+#endif
+    }
+    return NULL;
+}
+
+// Opens a file to write levels to, replacing what was there. Buffers hold
+// 'buffer_size' bytes, and workers wait if 'max_buffers' are all full.
+// io_uring is used if 'use_uring' is set and the system allows it.
+// Returns false if the file could not be opened.
+bool open_level_writer(Level_Writer * writer, char * path, size_t buffer_size, int max_buffers, bool use_uring) {
+    *writer = (Level_Writer){0};
+    writer->file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (writer->file < 0) return false;
+    writer->buffer_size = buffer_size;
+    writer->max_buffers = MAX(2, max_buffers);
+#if defined(__linux__)
+    writer->use_uring = use_uring && open_uring(&writer->uring, 64);
+#endif
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->work, NULL);
+    pthread_cond_init(&writer->freed, NULL);
+    if (pthread_create(&writer->thread, NULL, level_writer_thread, writer) != 0) {
+#if defined(__linux__)
+        if (writer->use_uring) close_uring(&writer->uring);
+#endif
+        close(writer->file);
+        return false;
+    }
+    return true;
+}
+
+// Gets an empty buffer to fill. Only waits if every buffer is waiting to
+// be written. Returns NULL if there was not enough memory.
+Write_Buffer * take_write_buffer(Level_Writer * writer) {
+    pthread_mutex_lock(&writer->lock);
+    while (!writer->free_buffers && writer->buffer_count >= writer->max_buffers) {
+        pthread_cond_wait(&writer->freed, &writer->lock);
+    }
+    Write_Buffer * buffer = writer->free_buffers;
+    if (buffer) {
+        writer->free_buffers = buffer->next;
+    } else {
+        buffer = malloc(sizeof(Write_Buffer) + writer->buffer_size);
+        if (buffer) {
+            *buffer = (Write_Buffer){ .bytes = (u8 *)(buffer + 1) };
+            ++writer->buffer_count;
+        }
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return buffer;
+}
+
+// Hands a filled buffer over to be written. It must not be used after this.
+// It goes right after the buffer queued before it in the file.
+// Returns where in the file it goes.
+u64 queue_write(Level_Writer * writer, Write_Buffer * buffer) {
+    if (buffer->size == 0) {
+        free_write_buffer(writer, buffer, true);
+        return writer->end_offset;
+    }
+    buffer->next = NULL;
+    buffer->written = 0;
+    pthread_mutex_lock(&writer->lock);
+    u64 offset = buffer->offset = writer->end_offset;
+    writer->end_offset += buffer->size;
+    if (writer->queue_tail) writer->queue_tail->next = buffer;
+    else writer->queue_head = buffer;
+    writer->queue_tail = buffer;
+    writer->most_queued = MAX(writer->most_queued, writer->queued + 1);
+    ++writer->queued;
+    pthread_cond_signal(&writer->work);
+    pthread_mutex_unlock(&writer->lock);
+    return offset;
+}
+
+// Waits for everything queued to be written, and closes the file.
+// Every worker must have queued its last buffer first.
+// Returns false if anything could not be written.
+bool close_level_writer(Level_Writer * writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->closing = true;
+    pthread_cond_signal(&writer->work);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+#if defined(__linux__)
+    if (writer->use_uring) close_uring(&writer->uring);
+#endif
+    while (writer->free_buffers) {
+        Write_Buffer * next = writer->free_buffers->next;
+        free(writer->free_buffers);
+        writer->free_buffers = next;
+    }
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->work);
+    pthread_cond_destroy(&writer->freed);
+    bool ok = !writer->failed;
+    if (close(writer->file) != 0) ok = false;
+    return ok;
+}